@@ -28,6 +28,7 @@ export LBM_RTP_PROXY_VERSION=%{version}-%{release}
 %install
 mkdir -p %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}
 install -D -p -m644 Makefile %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/Makefile
+install -D -p -m644 src/addr.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/addr.h
 install -D -p -m644 src/checksum.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/checksum.c
 install -D -p -m644 src/checksum.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/checksum.h
 install -D -p -m644 src/command.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/command.c
@@ -36,18 +37,28 @@ install -D -p -m644 src/config.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{rel
 install -D -p -m644 src/config.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/config.h
 install -D -p -m644 src/debug.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/debug.c
 install -D -p -m644 src/debug.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/debug.h
+install -D -p -m644 src/expire.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/expire.c
+install -D -p -m644 src/expire.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/expire.h
+install -D -p -m644 src/ingress.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/ingress.c
+install -D -p -m644 src/ingress.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/ingress.h
 install -D -p -m644 src/mangle.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/mangle.c
 install -D -p -m644 src/mangle.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/mangle.h
 install -D -p -m644 src/module.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/module.c
 install -D -p -m644 src/module.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/module.h
+install -D -p -m644 src/netns.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/netns.c
+install -D -p -m644 src/netns.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/netns.h
 install -D -p -m644 src/procfs.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/procfs.c
 install -D -p -m644 src/procfs.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/procfs.h
 install -D -p -m644 src/rewrite.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/rewrite.c
 install -D -p -m644 src/rewrite.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/rewrite.h
+install -D -p -m644 src/route.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/route.c
+install -D -p -m644 src/route.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/route.h
 install -D -p -m644 src/rtcp_packet.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/rtcp_packet.h
 install -D -p -m644 src/rtp_packet.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/rtp_packet.h
 install -D -p -m644 src/table.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/table.c
 install -D -p -m644 src/table.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/table.h
+install -D -p -m644 src/translate.c %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/translate.c
+install -D -p -m644 src/translate.h %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/src/translate.h
 install -D -p -m644 dist/dkms.conf.in %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/dkms.conf
 sed -i -e "s/__VSN__/%{version}-%{release}/g" %{buildroot}%{_usrsrc}/%{name}-%{version}-%{release}/dkms.conf
 install -D -p -m644 dist/lbm_rtp_proxy.conf %{buildroot}%{_sysconfdir}/modules-load.d/lbm_rtp_proxy.conf
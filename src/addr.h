@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ADDR_H_
+#define _ADDR_H_
+
+#ifdef __KERNEL__
+#include <linux/in6.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#endif
+
+#include "module.h"
+
+// Addresses of sessions and config are IPv6 addresses, IPv4 ones are mapped
+// into IPv6 (::ffff:a.b.c.d). The all zero address (::) stands for none, like
+// 0.0.0.0 did before, IPv4 0.0.0.0 maps to it. They are small enough to be
+// passed by value.
+
+#define ADDR_NONE ((struct in6_addr){ })
+
+static inline struct in6_addr addr_v4(__be32 v4) {
+  struct in6_addr addr = ADDR_NONE;
+  if(v4) {
+    addr.s6_addr32[2] = htonl(0x0000ffff);
+    addr.s6_addr32[3] = v4;
+  }
+  return addr;
+}
+
+static inline bool addr_is_v4(struct in6_addr addr) {
+  return !addr.s6_addr32[0] && !addr.s6_addr32[1] && addr.s6_addr32[2] == htonl(0x0000ffff);
+}
+
+// the IPv4 address of a mapped one, 0 for none
+static inline __be32 addr_to_v4(struct in6_addr addr) {
+  return addr_is_v4(addr) ? addr.s6_addr32[3] : 0;
+}
+
+static inline bool addr_is_set(struct in6_addr addr) {
+  return addr.s6_addr32[0] || addr.s6_addr32[1] || addr.s6_addr32[2] || addr.s6_addr32[3];
+}
+
+static inline bool addr_eq(struct in6_addr a, struct in6_addr b) {
+  return
+    a.s6_addr32[0] == b.s6_addr32[0] && a.s6_addr32[1] == b.s6_addr32[1] &&
+    a.s6_addr32[2] == b.s6_addr32[2] && a.s6_addr32[3] == b.s6_addr32[3];
+}
+
+// an order on addresses, none first
+static inline bool addr_lt(struct in6_addr a, struct in6_addr b) {
+  return memcmp(&a, &b, sizeof(a)) < 0;
+}
+
+// room for "[ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255]" and the zero
+#define ADDR_STR_SIZE 48
+
+// format addr for procfs and debug output into buf of ADDR_STR_SIZE, IPv4
+// addresses as before (0.0.0.0 for none) and IPv6 ones in brackets, so that
+// the ":port" following them stays unambiguous
+static inline const char *addr_str(char *buf, struct in6_addr addr) {
+  if(!addr_is_set(addr) || addr_is_v4(addr)) {
+    __be32 v4 = addr_to_v4(addr);
+    snprintf(buf, ADDR_STR_SIZE, "%pI4", &v4);
+  }
+  else {
+    snprintf(buf, ADDR_STR_SIZE, "[%pI6c]", &addr);
+  }
+  return buf;
+}
+
+#endif // _ADDR_H_
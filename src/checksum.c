@@ -17,12 +17,9 @@
 
 #include "checksum.h"
 
-static inline bool can_hw_csum(struct sk_buff *skb) {
-  return !skb->dev || skb->dev->features & (NETIF_F_IP_CSUM | NETIF_F_HW_CSUM);
-}
-
-static inline __wsum udp_csum_partial(struct udphdr *udp_header, __wsum csum) {
-  return csum_partial(udp_header, ntohs(udp_header->len), csum);
+// the payload may be paged, only the headers are linear
+static inline __wsum udp_csum_partial(struct sk_buff *skb, struct udphdr *udp_header, __wsum csum) {
+  return skb_checksum(skb, (uint8_t *)udp_header - skb->data, ntohs(udp_header->len), csum);
 }
 
 static inline __sum16 udp_csum_pseudo_header_partial(struct iphdr *ip_header, struct udphdr *udp_header) {
@@ -43,7 +40,7 @@ static inline __sum16 udp_csum_pseudo_header(struct iphdr *ip_header, struct udp
   }
 }
 
-static inline void verify_checksums(struct iphdr *ip_header, struct udphdr *udp_header) {
+static inline void verify_checksums(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header) {
   {
     __sum16 ip_check = ip_fast_csum((unsigned char *)ip_header, ip_header->ihl);
     if(ip_check != 0) {
@@ -52,7 +49,7 @@ static inline void verify_checksums(struct iphdr *ip_header, struct udphdr *udp_
   }
   {
     if(udp_header->check) {
-      __wsum csum = udp_csum_partial(udp_header, 0);
+      __wsum csum = udp_csum_partial(skb, udp_header, 0);
       __sum16 udp_check = ~udp_csum_pseudo_header(ip_header, udp_header, csum);
       if(udp_check != 0) {
         printk(BANNER " !!! verify_checksums: udp_csum_partial/udp_csum_pseudo_header check failed! expected:"CSUM_FMT" actual:"CSUM_FMT"\n", ntohs(0), ntohs(udp_check));
@@ -76,15 +73,27 @@ static inline void verify_checksums_partial(struct iphdr *ip_header, struct udph
   }
 }
 
-void handle_incoming_checksums(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header) {
+// a zero UDP checksum means there is none
+static inline bool is_udp_checksum_ok(struct sk_buff *skb, unsigned int hook, struct udphdr *udp_header) {
+  return !udp_header->check || !nf_ip_checksum(skb, hook, (uint8_t *)udp_header - skb->data, IPPROTO_UDP);
+}
+
+bool handle_incoming_checksums(struct sk_buff *skb, unsigned int hook, struct iphdr *ip_header, struct udphdr *udp_header, uint8_t policy) {
   //  A. Checksumming of received packets by device.
   switch(skb->ip_summed) {
   case CHECKSUM_NONE:
     //    Device failed to checksum this packet e.g. due to lack of capabilities.
     //    The packet contains full (though not verified) checksum in packet but
     //    not in skb->csum. Thus, skb->csum is undefined in this case.
-    verify_checksums(ip_header, udp_header); // FIXME actuallay check if checksum is okay
-    //skb->ip_summed = CHECKSUM_UNNECESSARY;
+    //
+    //    Only this case needs a pass over the payload, and only if asked for.
+    if(policy == CHECKSUM_POLICY_VERIFY && !is_udp_checksum_ok(skb, hook, udp_header)) {
+      debug_printk(BANNER " !!! bad UDP checksum -> DROP\n");
+      return false;
+    }
+#ifdef DEBUG
+    verify_checksums(skb, ip_header, udp_header);
+#endif
     break;
   case CHECKSUM_UNNECESSARY:
     //    The hardware you're dealing with doesn't calculate the full checksum
@@ -113,7 +122,7 @@ void handle_incoming_checksums(struct sk_buff *skb, struct iphdr *ip_header, str
     //    checksum is bad, skb->csum_level would be set to zero (TCP checksum is
     //    not considered in this case).
 #ifdef DEBUG
-    verify_checksums(ip_header, udp_header);
+    verify_checksums(skb, ip_header, udp_header);
 #endif
     break;
   case CHECKSUM_COMPLETE:
@@ -123,11 +132,15 @@ void handle_incoming_checksums(struct sk_buff *skb, struct iphdr *ip_header, str
     //
     //    Note: Even if device supports only some protocols, but is able to produce
     //    skb->csum, it MUST use CHECKSUM_COMPLETE, not CHECKSUM_UNNECESSARY.
-    debug_printk(BANNER " !!! WARNING(incoming): unsupported checksum type: %s\n", ip_summed_toString(skb->ip_summed));
+    //
+    //    Rewritten fields get updated in skb->csum as well, see below.
+    if(policy == CHECKSUM_POLICY_VERIFY && !is_udp_checksum_ok(skb, hook, udp_header)) {
+      debug_printk(BANNER " !!! bad UDP checksum -> DROP\n");
+      return false;
+    }
 #ifdef DEBUG
-    verify_checksums(ip_header, udp_header);
+    verify_checksums(skb, ip_header, udp_header);
 #endif
-    skb->ip_summed = CHECKSUM_UNNECESSARY;
     break;
   case CHECKSUM_PARTIAL:
     //    This is identical to the case for output below. This may occur on a packet
@@ -142,95 +155,132 @@ void handle_incoming_checksums(struct sk_buff *skb, struct iphdr *ip_header, str
   default:
     break;
   }
+  // without a checksum the rewrite has nothing to update, GSO needs the
+  // checksum offload though
+  if(policy == CHECKSUM_POLICY_ZERO && !skb_is_gso(skb)) {
+    udp_header->check = 0;
+    if(skb->ip_summed == CHECKSUM_PARTIAL || skb->ip_summed == CHECKSUM_COMPLETE) {
+      skb->ip_summed = CHECKSUM_NONE;
+    }
+  }
+  return true;
 }
 
-static inline void calculate_ip_checksum(struct iphdr *ip_header) {
-#ifdef DEBUG
-  __sum16 ip_check  = ip_header->check;
+#if IS_ENABLED(CONFIG_IPV6)
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 19, 0)
+// nf_ip6_checksum() is not exported before 4.19, the same check of the UDP
+// datagram at dataoff against the pseudo header, non-zero if it fails
+static __sum16 udp6_checksum(struct sk_buff *skb, unsigned int hook, unsigned int dataoff, uint8_t protocol) {
+  const struct ipv6hdr *ip6_header = ipv6_hdr(skb);
+  unsigned int len = skb->len - dataoff;
+  if(skb->ip_summed == CHECKSUM_COMPLETE &&
+     !csum_ipv6_magic(&ip6_header->saddr, &ip6_header->daddr, len, protocol,
+                      csum_sub(skb->csum, skb_checksum(skb, 0, dataoff, 0)))) {
+    skb->ip_summed = CHECKSUM_UNNECESSARY;
+    return 0;
+  }
+  skb->csum = ~csum_unfold(csum_ipv6_magic(&ip6_header->saddr, &ip6_header->daddr, len, protocol,
+                                           csum_sub(0, skb_checksum(skb, 0, dataoff, 0))));
+  return __skb_checksum_complete(skb);
+}
+#else
+#define udp6_checksum nf_ip6_checksum
 #endif
 
-  ip_header->check = 0;
-  ip_header->check = ip_fast_csum((unsigned char *)ip_header, ip_header->ihl);
-  debug_printk(BANNER " ip  csum: "CSUM_FMT" -> "CSUM_FMT"\n", ntohs(ip_check),  ntohs(ip_header->check));
+// IPv6 has no header checksum, and the UDP checksum is mandatory, so the zero
+// policy does not apply. Devices only leave a checksum to verify under
+// CHECKSUM_NONE and CHECKSUM_COMPLETE, like for IPv4.
+bool handle_incoming_checksums6(struct sk_buff *skb, unsigned int hook, struct udphdr *udp_header, uint8_t policy) {
+  if(policy == CHECKSUM_POLICY_VERIFY &&
+     (skb->ip_summed == CHECKSUM_NONE || skb->ip_summed == CHECKSUM_COMPLETE) &&
+     udp6_checksum(skb, hook, (uint8_t *)udp_header - skb->data, IPPROTO_UDP)) {
+    debug_printk(BANNER " !!! bad UDP checksum -> DROP\n");
+    return false;
+  }
+  return true;
 }
-
-static inline void calculate_pseudo_header_udp_checksum(struct iphdr *ip_header, struct udphdr *udp_header) {
-#ifdef DEBUG
-  __sum16 udp_check = udp_header->check;
 #endif
 
-  udp_header->check = udp_csum_pseudo_header_partial(ip_header, udp_header);
-  debug_printk(BANNER " udp pseudo header csum: "CSUM_FMT" -> "CSUM_FMT"\n", ntohs(udp_check), ntohs(udp_header->check));
-}
+////////////////////////////////////////////////////////////////////////////////
+//
+// incremental checksum updates (RFC 1624) of rewritten fields: only the
+// difference between the old and the new value of a field goes into the
+// checksums, so the cost does not depend on the payload size. The helpers of
+// the kernel also keep skb->csum right under CHECKSUM_COMPLETE, and only
+// update the pseudo header sum under CHECKSUM_PARTIAL.
+//
+////////////////////////////////////////////////////////////////////////////////
 
-static inline void calculate_udp_checksum_full(struct iphdr *ip_header, struct udphdr *udp_header) {
-#ifdef DEBUG
-  __sum16 udp_check = udp_header->check;
-#endif
+// a zero UDP checksum means there is none, unless the device computes it
+static inline bool has_udp_checksum(struct sk_buff *skb, struct udphdr *udp_header) {
+  return udp_header->check || skb->ip_summed == CHECKSUM_PARTIAL;
+}
 
-  __wsum csum       = 0;
-  udp_header->check = 0;
-  csum              = udp_csum_partial(udp_header, csum);
-  udp_header->check = udp_csum_pseudo_header(ip_header, udp_header, csum);
-  debug_printk(BANNER " udp csum: "CSUM_FMT" -> "CSUM_FMT"\n", ntohs(udp_check), ntohs(udp_header->check));
+static inline void mangle_zero_udp_checksum(struct sk_buff *skb, struct udphdr *udp_header) {
+  if(!udp_header->check && skb->ip_summed != CHECKSUM_PARTIAL) {
+    udp_header->check = CSUM_MANGLED_0;
+  }
 }
 
-static inline bool is_local_out(struct sk_buff *skb) {
-  struct rtable *rt = skb_rtable(skb);
-  return rt && rt->rt_flags & RTCF_LOCAL;
+void checksum_replace_addr(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header, __be32 *addr, __be32 to) {
+  __be32 from = *addr;
+  if(from != to) {
+    csum_replace4(&ip_header->check, from, to);
+    if(has_udp_checksum(skb, udp_header)) {
+      inet_proto_csum_replace4(&udp_header->check, skb, from, to, true);
+      mangle_zero_udp_checksum(skb, udp_header);
+    }
+    *addr = to;
+  }
 }
 
-void handle_outgoing_checksums(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header) {
-  //  B. Checksumming on output.
-  switch(skb->ip_summed) {
-  case CHECKSUM_PARTIAL:
-    //    The device is required to checksum the packet as seen by hard_start_xmit()
-    //    from skb->csum_start up to the end, and to record/write the checksum at
-    //    offset skb->csum_start + skb->csum_offset.
-    //
-    //    The device must show its capabilities in dev->features, set up at device
-    //    setup time, e.g. netdev_features.h:
-    //
-    //       NETIF_F_HW_CSUM - It's a clever device, it's able to checksum everything.
-    //       NETIF_F_IP_CSUM - Device is dumb, it's able to checksum only TCP/UDP over
-    //                         IPv4. Sigh. Vendors like this way for an unknown reason.
-    //                         Though, see comment above about CHECKSUM_UNNECESSARY. 8)
-    //       NETIF_F_IPV6_CSUM - About as dumb as the last one but does IPv6 instead.
-    //       NETIF_F_...     - Well, you get the picture.
-    calculate_ip_checksum(ip_header);
-    calculate_pseudo_header_udp_checksum(ip_header, udp_header);
-
-    debug_print_skb(" keeping CHECKSUM_PARTIAL", skb, ip_header, udp_header);
-    break;
-  case CHECKSUM_NONE:
-    //    The skb was already checksummed by the protocol, or a checksum is not
-    //    required.
-  case CHECKSUM_UNNECESSARY:
-    //    Normally, the device will do per protocol specific checksumming. Protocol
-    //    implementations that do not want the NIC to perform the checksum
-    //    calculation should use this flag in their outgoing skbs.
-    //
-    //       NETIF_F_FCOE_CRC - This indicates that the device can do FCoE FC CRC
-    //                          offload. Correspondingly, the FCoE protocol driver
-    //                          stack should use CHECKSUM_UNNECESSARY.
-  default:
-    //debug_printk(BANNER " !!! WARNING(outgoing): unsupported checksum type: %s\n", ip_summed_toString(skb->ip_summed));
-    calculate_ip_checksum(ip_header);
-    if(!is_local_out(skb) && can_hw_csum(skb)) {
-      skb->ip_summed   = CHECKSUM_PARTIAL;
-      skb->csum_start  = skb_transport_header(skb) - skb->head;
-      skb->csum_offset = offsetof(struct udphdr, check);
+void checksum_replace_be16(struct sk_buff *skb, struct udphdr *udp_header, __be16 *field, __be16 to) {
+  __be16 from = *field;
+  if(from != to) {
+    if(has_udp_checksum(skb, udp_header)) {
+      inet_proto_csum_replace2(&udp_header->check, skb, from, to, false);
+      mangle_zero_udp_checksum(skb, udp_header);
+    }
+    *field = to;
+  }
+}
 
-      calculate_pseudo_header_udp_checksum(ip_header, udp_header);
+// set an address of the IPv6 header, which only the UDP checksum covers
+void checksum_replace_addr6(struct sk_buff *skb, struct udphdr *udp_header, struct in6_addr *addr, struct in6_addr to) {
+  if(!addr_eq(*addr, to)) {
+    inet_proto_csum_replace16(&udp_header->check, skb, addr->s6_addr32, to.s6_addr32, true);
+    mangle_zero_udp_checksum(skb, udp_header);
+    *addr = to;
+  }
+}
 
-      debug_print_skb(" going from CHECKSUM_UNNECESSARY to CHECKSUM_PARTIAL", skb, ip_header, udp_header);
-    }
-    else {
-      calculate_udp_checksum_full(ip_header, udp_header);
+// a packet changing its IP version keeps the length and protocol of the
+// pseudo header, only the addresses change. IPv6 requires the checksum that
+// IPv4 can leave out, it gets computed for packets without one.
+void checksum_pseudo_to_ipv6(struct sk_buff *skb, struct udphdr *udp_header,
+                             __be32 saddr, __be32 daddr, struct in6_addr saddr6, struct in6_addr daddr6) {
+  struct in6_addr none = ADDR_NONE;
+  if(has_udp_checksum(skb, udp_header)) {
+    inet_proto_csum_replace4(&udp_header->check, skb, saddr, 0, true);
+    inet_proto_csum_replace4(&udp_header->check, skb, daddr, 0, true);
+    inet_proto_csum_replace16(&udp_header->check, skb, none.s6_addr32, saddr6.s6_addr32, true);
+    inet_proto_csum_replace16(&udp_header->check, skb, none.s6_addr32, daddr6.s6_addr32, true);
+  }
+  else {
+    udp_header->check = csum_ipv6_magic(&saddr6, &daddr6, ntohs(udp_header->len), IPPROTO_UDP,
+                                        udp_csum_partial(skb, udp_header, 0));
+  }
+  mangle_zero_udp_checksum(skb, udp_header);
+}
 
-      debug_print_skb(" keeping CHECKSUM_UNNECESSARY", skb, ip_header, udp_header);
-    }
-    break;
+void checksum_pseudo_to_ipv4(struct sk_buff *skb, struct udphdr *udp_header,
+                             struct in6_addr saddr6, struct in6_addr daddr6, __be32 saddr, __be32 daddr) {
+  struct in6_addr none = ADDR_NONE;
+  if(has_udp_checksum(skb, udp_header)) {
+    inet_proto_csum_replace16(&udp_header->check, skb, saddr6.s6_addr32, none.s6_addr32, true);
+    inet_proto_csum_replace16(&udp_header->check, skb, daddr6.s6_addr32, none.s6_addr32, true);
+    inet_proto_csum_replace4(&udp_header->check, skb, 0, saddr, true);
+    inet_proto_csum_replace4(&udp_header->check, skb, 0, daddr, true);
+    mangle_zero_udp_checksum(skb, udp_header);
   }
-  //  Any questions? No questions, good.           --ANK
 }
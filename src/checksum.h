@@ -19,14 +19,42 @@
 #define _CHECKSUM_H_
 
 #ifdef __KERNEL__
+#include <linux/netfilter.h>
+#include <linux/netfilter_ipv6.h>
+#include <linux/version.h>
 #include <net/ip.h>
+#include <net/ip6_checksum.h>
 #endif
 
 #include "module.h"
 #include "debug.h"
 
-void handle_incoming_checksums(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header);
+#include "config.h"
 
-void handle_outgoing_checksums(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header);
+// checks the checksums of a packet entering the proxy according to the
+// checksum policy, returns false if the packet has to be dropped
+bool handle_incoming_checksums(struct sk_buff *skb, unsigned int hook, struct iphdr *ip_header, struct udphdr *udp_header, uint8_t policy);
+
+#if IS_ENABLED(CONFIG_IPV6)
+// the same for IPv6, where only the verify policy makes a difference
+bool handle_incoming_checksums6(struct sk_buff *skb, unsigned int hook, struct udphdr *udp_header, uint8_t policy);
+#endif
+
+// set an address of the IP header and update the IP and UDP checksums
+void checksum_replace_addr(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header, __be32 *addr, __be32 to);
+
+// set an address of the IPv6 header and update the UDP checksum
+void checksum_replace_addr6(struct sk_buff *skb, struct udphdr *udp_header, struct in6_addr *addr, struct in6_addr to);
+
+// replace the IPv4 addresses of the UDP pseudo header by IPv6 ones
+void checksum_pseudo_to_ipv6(struct sk_buff *skb, struct udphdr *udp_header,
+                             __be32 saddr, __be32 daddr, struct in6_addr saddr6, struct in6_addr daddr6);
+
+// replace the IPv6 addresses of the UDP pseudo header by IPv4 ones
+void checksum_pseudo_to_ipv4(struct sk_buff *skb, struct udphdr *udp_header,
+                             struct in6_addr saddr6, struct in6_addr daddr6, __be32 saddr, __be32 daddr);
+
+// set a 16 bit field of the UDP header or payload and update the UDP checksum
+void checksum_replace_be16(struct sk_buff *skb, struct udphdr *udp_header, __be16 *field, __be16 to);
 
 #endif // _CHECKSUM_H_
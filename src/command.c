@@ -17,7 +17,7 @@
 
 #include "command.h"
 
-#include <linux/random.h>
+#include <linux/inet.h>
 
 #include "debug.h"
 
@@ -25,24 +25,64 @@
 //
 // command handling functions
 //
-// "a <proxy_port> <sender_ip>:<sender_port> <receiver_ip>:<receiver_port> <sbc_ip>:<sbc_port>"
-//   add proxy route
+// "a <proxy_port> <sender_ip>:<sender_port> <receiver_ip>:<receiver_port> <sbc_ip>:<sbc_port> [<int_proxy_ip> <ext_proxy_ip> | <realm>]"
+//   add proxy route, optionally on other than the configured proxy IPs. IPs
+//   are IPv4 (a.b.c.d) or IPv6 addresses, IPv6 ones in brackets when followed
+//   by a port ([2001:db8::1]:4000). The internal side (sender, receiver and
+//   internal proxy IP) and the external side (SBC and external proxy IP) may
+//   be of different IP versions, the packets get translated when relayed
 //
-// "d <proxy_port>"
+// "d <proxy_port> [<int_proxy_ip> | <realm>]"
 //   delete proxy route
 //
 // "c <int_proxy_ip> <ext_proxy_ip>"
 //   configure proxy IPs
 //
+// "r <realm> <int_proxy_ip> <ext_proxy_ip>"
+//   configure the proxy IPs of a realm, moves the routes of the realm
+//
 // "s <smoothing (0|1)>
 //   configure RTP serial number/ssrc smoothing
 //
 // "l <loopback (0|1)>
 //   configure support for loopback routing
 //
+// "p <single_pass (0|1)>"
+//   rewrite relayed packets completely in PRE_ROUTING and transmit them from
+//   there on a route cached per session, skipping the rest of the stack
+//
+// "v <checksum_policy (trust|verify|zero)>"
+//   trust the UDP checksums of incoming packets, verify them in software if
+//   the device did not and drop bad packets, or send packets without UDP
+//   checksum
+//
+// "n <notrack (0|1)>"
+//   mark packets of known sessions untracked, like the NOTRACK target, so
+//   that conntrack keeps no state for proxied flows
+//
+// "i <device> <ingress (0|1)>"
+//   relay packets received on device right from its netdev ingress hook,
+//   before IP receive processing, if single pass is configured and they can
+//   be relayed in a single pass. Applies to the namespace, not to the
+//   (staged) instance.
+//
+// "t <idle_timeout>"
+//   expire routes without packets for idle_timeout seconds, 0 disables expiry
+//
 // "f"
 //   flush configuration and table entries by setting it to all zero
 //
+// "b"
+//   begin staging: following commands build an empty instance which is not
+//   used for packets yet, a previously staged instance is discarded
+//
+// "e"
+//   end staging: atomically replace the live instance by the staged one,
+//   routes present in both keep their RTP state
+//
+// "x"
+//   discard the staged instance
+//
 ////////////////////////////////////////////////////////////////////////////////
 
 static inline void *update_table_function(struct table_entry *entry, void *arg) {
@@ -54,121 +94,297 @@ static inline void *update_table_function(struct table_entry *entry, void *arg)
   entry->receiver_port = ent->receiver_port;
   entry->sbc_addr      = ent->sbc_addr;
   entry->sbc_port      = ent->sbc_port;
+  entry->ext_proxy_addr = ent->ext_proxy_addr;
+  entry->realm         = ent->realm;
+
+  return arg;
+}
+
+#define REALM_FMT "%15s"
+
+// an address or an address and port, long enough for any IPv6 one
+#define TOKEN_LEN 64
+#define TOKEN_FMT "%63s"
 
-  if(!entry->offset_set) {
-    uint16_t random_sn;
-    get_random_bytes(&random_sn, sizeof(random_sn));
-    entry->offset = random_sn;
-    entry->offset_set = 1;
+// parse an IPv4 or IPv6 address
+static bool parse_addr(const char *token, struct in6_addr *addr) {
+  __be32 v4;
+  if(in4_pton(token, -1, (u8 *)&v4, '\0', NULL)) {
+    *addr = addr_v4(v4);
+    return true;
   }
+  return in6_pton(token, -1, addr->s6_addr, '\0', NULL);
+}
 
-  return arg;
+// parse <ip>:<port>, with the IP in brackets if it is an IPv6 address
+static bool parse_addr_port(const char *token, struct in6_addr *addr, __be16 *port) {
+  const char *end;
+  uint16_t p;
+  __be32 v4;
+  if(token[0] == '[') {
+    if(!in6_pton(token + 1, -1, addr->s6_addr, ']', &end) || *++end != ':') {
+      return false;
+    }
+  }
+  else {
+    if(!in4_pton(token, -1, (u8 *)&v4, ':', &end) || *end != ':') {
+      return false;
+    }
+    *addr = addr_v4(v4);
+  }
+  if(kstrtou16(end + 1, 10, &p)) {
+    return false;
+  }
+  *port = htons(p);
+  return true;
 }
 
-static void command_add(const char *parameters) {
-  uint16_t proxy_port;
+// fill in the proxy addresses of a realm, returns false if there is none
+static bool parse_realm(struct rtp_proxy_instance *instance, const char *name, struct table_entry *ent) {
+  struct realm realm;
+  uint8_t id = realm_find(&instance->config, name);
+  if(realm_get(&instance->config, id, &realm)) {
+    ent->int_proxy_addr = realm.int_proxy_addr;
+    ent->ext_proxy_addr = realm.ext_proxy_addr;
+    ent->realm = id;
+    return true;
+  }
+  debug_printk(BANNER "unknown realm %s\n", name);
+  return false;
+}
 
-  uint8_t sender_ip[4];
-  uint16_t sender_port;
+static void command_add(struct rtp_proxy_instance *instance, const char *parameters) {
+  uint16_t proxy_port;
 
-  uint8_t receiver_ip[4];
-  uint16_t receiver_port;
+  char sender[TOKEN_LEN];
+  char receiver[TOKEN_LEN];
+  char sbc[TOKEN_LEN];
 
-  uint8_t sbc_ip[4];
-  uint16_t sbc_port;
+  int consumed = 0;
 
-  if(16 == sscanf(parameters, " "PORT_FMT" "IP_PORT_FMT" "IP_PORT_FMT" "IP_PORT_FMT" ",
-                  &proxy_port,
-                  &sender_ip[0],   &sender_ip[1],   &sender_ip[2],   &sender_ip[3],   &sender_port,
-                  &receiver_ip[0], &receiver_ip[1], &receiver_ip[2], &receiver_ip[3], &receiver_port,
-                  &sbc_ip[0],      &sbc_ip[1],      &sbc_ip[2],      &sbc_ip[3],      &sbc_port)) {
+  empty_struct(table_entry, ent);
 
-    __be16 index = htons(proxy_port);
+  if(4 == sscanf(parameters, " "PORT_FMT" "TOKEN_FMT" "TOKEN_FMT" "TOKEN_FMT"%n",
+                 &proxy_port, sender, receiver, sbc,
+                 &consumed) &&
+     parse_addr_port(sender, &ent.sender_addr, &ent.sender_port) &&
+     parse_addr_port(receiver, &ent.receiver_addr, &ent.receiver_port) &&
+     parse_addr_port(sbc, &ent.sbc_addr, &ent.sbc_port)) {
+    const char *options = &parameters[consumed];
 
-    struct table_entry ent = {
-      .sender_addr = htonl(atohl(sender_ip)),
-      .sender_port = htons(sender_port),
+    char int_proxy_ip[TOKEN_LEN];
+    char ext_proxy_ip[TOKEN_LEN];
+    char realm[REALM_NAME_LEN];
 
-      .receiver_addr = htonl(atohl(receiver_ip)),
-      .receiver_port = htons(receiver_port),
+    __be16 index = htons(proxy_port);
 
-      .sbc_addr = htonl(atohl(sbc_ip)),
-      .sbc_port = htons(sbc_port),
-    };
+    if(2 == sscanf(options, " "TOKEN_FMT" "TOKEN_FMT" ", int_proxy_ip, ext_proxy_ip)) {
+      if(!parse_addr(int_proxy_ip, &ent.int_proxy_addr) || !parse_addr(ext_proxy_ip, &ent.ext_proxy_addr)) {
+        debug_printk(BANNER "command a failed\n");
+        return;
+      }
+    }
+    else if(1 == sscanf(options, " "REALM_FMT" ", realm) && !parse_realm(instance, realm, &ent)) {
+      debug_printk(BANNER "command a failed\n");
+      return;
+    }
 
-    table_atomically(index, update_table_function, &ent);
+    table_update(&instance->table, index, ent.int_proxy_addr, update_table_function, &ent);
   }
   else {
     debug_printk(BANNER "command a failed\n");
   }
 }
 
-static void command_delete(const char *parameters) {
+static void command_delete(struct rtp_proxy_instance *instance, const char *parameters) {
   uint16_t proxy_port;
+  int consumed = 0;
+
+  if(1 == sscanf(parameters, " "PORT_FMT"%n",
+                 &proxy_port,
+                 &consumed)) {
+    const char *options = &parameters[consumed];
+
+    char token[TOKEN_LEN];
 
-  if(1 == sscanf(parameters, " "PORT_FMT" ",
-                 &proxy_port)) {
     __be16 key = htons(proxy_port);
 
-    table_del(key);
+    empty_struct(table_entry, ent);
+
+    if(1 == sscanf(options, " "TOKEN_FMT" ", token) &&
+       !parse_addr(token, &ent.int_proxy_addr) && !parse_realm(instance, token, &ent)) {
+      debug_printk(BANNER "command d failed\n");
+      return;
+    }
+
+    table_del(&instance->table, key, ent.int_proxy_addr);
   }
   else {
     debug_printk(BANNER "command d failed\n");
   }
 }
 
-static void command_configure(const char *parameters) {
-  uint8_t int_proxy_ip[4];
-  uint8_t ext_proxy_ip[4];
+static void command_configure(struct rtp_proxy_instance *instance, const char *parameters) {
+  char int_proxy_ip[TOKEN_LEN];
+  char ext_proxy_ip[TOKEN_LEN];
+  struct in6_addr int_proxy_addr;
+  struct in6_addr ext_proxy_addr;
 
-  if(8 == sscanf(parameters, " "IP_FMT" "IP_FMT" ",
-                 &int_proxy_ip[0], &int_proxy_ip[1], &int_proxy_ip[2], &int_proxy_ip[3],
-                 &ext_proxy_ip[0], &ext_proxy_ip[1], &ext_proxy_ip[2], &ext_proxy_ip[3])) {
+  if(2 == sscanf(parameters, " "TOKEN_FMT" "TOKEN_FMT" ", int_proxy_ip, ext_proxy_ip) &&
+     parse_addr(int_proxy_ip, &int_proxy_addr) && parse_addr(ext_proxy_ip, &ext_proxy_addr)) {
     struct config cfg;
-    config_get(&cfg);
-    cfg.int_proxy_addr = htonl(atohl(int_proxy_ip));
-    cfg.ext_proxy_addr = htonl(atohl(ext_proxy_ip));
-    config_set(&cfg);
+    config_get(&instance->config, &cfg);
+    cfg.int_proxy_addr = int_proxy_addr;
+    cfg.ext_proxy_addr = ext_proxy_addr;
+    config_set(&instance->config, &cfg);
+    table_refresh(&instance->table);
   }
   else {
     debug_printk(BANNER "command c failed\n");
   }
 }
 
-static void command_smoothing(const char *parameters) {
+static void command_realm(struct rtp_proxy_instance *instance, const char *parameters) {
+  char realm[REALM_NAME_LEN];
+  char int_proxy_ip[TOKEN_LEN];
+  char ext_proxy_ip[TOKEN_LEN];
+  struct in6_addr int_proxy_addr;
+  struct in6_addr ext_proxy_addr;
+
+  if(3 == sscanf(parameters, " "REALM_FMT" "TOKEN_FMT" "TOKEN_FMT" ", realm, int_proxy_ip, ext_proxy_ip) &&
+     parse_addr(int_proxy_ip, &int_proxy_addr) && parse_addr(ext_proxy_ip, &ext_proxy_addr)) {
+    uint8_t id = realm_set(&instance->config, realm, int_proxy_addr, ext_proxy_addr);
+    if(id) {
+      table_realm_changed(&instance->table, id);
+    }
+    else {
+      debug_printk(BANNER "command r failed, too many realms\n");
+    }
+  }
+  else {
+    debug_printk(BANNER "command r failed\n");
+  }
+}
+
+static void command_smoothing(struct rtp_proxy_instance *instance, const char *parameters) {
   uint8_t smoothing;
 
   if(1 == sscanf(parameters, " "U8_FMT" ",
                  &smoothing)) {
     struct config cfg;
-    config_get(&cfg);
+    config_get(&instance->config, &cfg);
     cfg.smoothing = smoothing;
-    config_set(&cfg);
+    config_set(&instance->config, &cfg);
+    table_refresh(&instance->table);
   }
   else {
     debug_printk(BANNER "command s failed\n");
   }
 }
 
-static void command_loopback(const char *parameters) {
+static void command_loopback(struct rtp_proxy_instance *instance, const char *parameters) {
   uint8_t loopback;
 
   if(1 == sscanf(parameters, " "U8_FMT" ",
                  &loopback)) {
     struct config cfg;
-    config_get(&cfg);
+    config_get(&instance->config, &cfg);
     cfg.loopback = loopback;
-    config_set(&cfg);
+    config_set(&instance->config, &cfg);
+    table_refresh(&instance->table);
   }
   else {
     debug_printk(BANNER "command s failed\n");
   }
 }
 
-static void command_flush(const char *parameters) {
+static void command_single_pass(struct rtp_proxy_instance *instance, const char *parameters) {
+  uint8_t single_pass;
+
+  if(1 == sscanf(parameters, " "U8_FMT" ",
+                 &single_pass)) {
+    struct config cfg;
+    config_get(&instance->config, &cfg);
+    cfg.single_pass = single_pass;
+    config_set(&instance->config, &cfg);
+    table_refresh(&instance->table);
+  }
+  else {
+    debug_printk(BANNER "command p failed\n");
+  }
+}
+
+static void command_checksum(struct rtp_proxy_instance *instance, const char *parameters) {
+  char name[8];
+  uint8_t policy = CHECKSUM_POLICIES;
+
+  if(1 == sscanf(parameters, " %7s ", name)) {
+    policy = checksum_policy_find(name);
+  }
+  if(policy < CHECKSUM_POLICIES) {
+    struct config cfg;
+    config_get(&instance->config, &cfg);
+    cfg.checksum = policy;
+    config_set(&instance->config, &cfg);
+    table_refresh(&instance->table);
+  }
+  else {
+    debug_printk(BANNER "command v failed\n");
+  }
+}
+
+static void command_notrack(struct rtp_proxy_instance *instance, const char *parameters) {
+  uint8_t notrack;
+
+  if(1 == sscanf(parameters, " "U8_FMT" ",
+                 &notrack)) {
+    struct config cfg;
+    config_get(&instance->config, &cfg);
+    cfg.notrack = notrack;
+    config_set(&instance->config, &cfg);
+    table_refresh(&instance->table);
+  }
+  else {
+    debug_printk(BANNER "command n failed\n");
+  }
+}
+
+static bool command_ingress(struct rtp_proxy_net *proxy, const char *parameters) {
+  char name[IFNAMSIZ];
+  uint8_t ingress;
+  int err = -EINVAL;
+
+  if(2 == sscanf(parameters, " %15s "U8_FMT" ",
+                 name, &ingress)) {
+    err = ingress ? ingress_attach(&proxy->ingress, name) : ingress_detach(&proxy->ingress, name);
+  }
+  if(err) {
+    debug_printk(BANNER "command i failed (%d)\n", err);
+    return false;
+  }
+  return true;
+}
+
+static void command_timeout(struct rtp_proxy_instance *instance, const char *parameters) {
+  uint32_t idle_timeout;
+
+  if(1 == sscanf(parameters, " %u ",
+                 &idle_timeout)) {
+    struct config cfg;
+    config_get(&instance->config, &cfg);
+    cfg.idle_timeout = idle_timeout;
+    config_set(&instance->config, &cfg);
+    table_refresh(&instance->table);
+  }
+  else {
+    debug_printk(BANNER "command t failed\n");
+  }
+}
+
+static void command_flush(struct rtp_proxy_instance *instance, const char *parameters) {
   if(0 == sscanf(parameters, " ")) {
-    config_clr();
-    table_clr();
+    config_clr(&instance->config);
+    table_clr(&instance->table);
   }
   else {
     debug_printk(BANNER "command f failed\n");
@@ -176,28 +392,62 @@ static void command_flush(const char *parameters) {
 }
 
 // required by procfs.c
-bool handle_command(const char *command) {
-  debug_printk(BANNER "command: %s\n", command);
+static bool dispatch_command(struct rtp_proxy_net *proxy, const char *command) {
+  struct rtp_proxy_instance *instance = proxy_target(proxy);
   switch(command[0]) {
   case 'a':
-    command_add(&command[1]);
+    command_add(instance, &command[1]);
     return true;
   case 'd':
-    command_delete(&command[1]);
+    command_delete(instance, &command[1]);
     return true;
   case 'c':
-    command_configure(&command[1]);
+    command_configure(instance, &command[1]);
+    return true;
+  case 'r':
+    command_realm(instance, &command[1]);
     return true;
   case 's':
-    command_smoothing(&command[1]);
+    command_smoothing(instance, &command[1]);
     return true;
   case 'l':
-    command_loopback(&command[1]);
+    command_loopback(instance, &command[1]);
+    return true;
+  case 'p':
+    command_single_pass(instance, &command[1]);
+    return true;
+  case 'v':
+    command_checksum(instance, &command[1]);
+    return true;
+  case 'n':
+    command_notrack(instance, &command[1]);
+    return true;
+  case 'i':
+    return command_ingress(proxy, &command[1]);
+  case 't':
+    command_timeout(instance, &command[1]);
     return true;
   case 'f':
-    command_flush(&command[1]);
+    command_flush(instance, &command[1]);
+    return true;
+  case 'b':
+    return proxy_stage(proxy);
+  case 'e':
+    return proxy_commit(proxy);
+  case 'x':
+    proxy_abort(proxy);
     return true;
   default:
     return false;
   }
 }
+
+bool handle_command(struct rtp_proxy_net *proxy, const char *command) {
+  bool result;
+  debug_printk(BANNER "command: %s\n", command);
+  mutex_lock(&proxy->lock);
+  result = dispatch_command(proxy, command);
+  expire_update(&proxy->expire);
+  mutex_unlock(&proxy->lock);
+  return result;
+}
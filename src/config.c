@@ -17,46 +17,164 @@
 
 #include "config.h"
 
-static spinlock_t config_lock;
-static struct config config;
-
 #ifdef DEBUG
 static void config_print(struct config *cfg) {
-  uint8_t int_proxy_ip[4] = htoal(ntohl(cfg->int_proxy_addr));
-  uint8_t ext_proxy_ip[4] = htoal(ntohl(cfg->ext_proxy_addr));
+  char int_proxy_ip[ADDR_STR_SIZE];
+  char ext_proxy_ip[ADDR_STR_SIZE];
   uint8_t smoothing = cfg->smoothing;
   uint8_t loopback = cfg->loopback;
-  printk(BANNER "config:" " int_proxy_addr: "IP_FMT " ext_proxy_addr: "IP_FMT" smoothing: "U8_FMT" loopback: "U8_FMT"\n",
-         int_proxy_ip[0], int_proxy_ip[1], int_proxy_ip[2], int_proxy_ip[3],
-         ext_proxy_ip[0], ext_proxy_ip[1], ext_proxy_ip[2], ext_proxy_ip[3],
+  printk(BANNER "config:" " int_proxy_addr: %s ext_proxy_addr: %s smoothing: "U8_FMT" loopback: "U8_FMT"\n",
+         addr_str(int_proxy_ip, cfg->int_proxy_addr),
+         addr_str(ext_proxy_ip, cfg->ext_proxy_addr),
          smoothing, loopback);
 }
 #else
 #define config_print(x) do {} while(0)
 #endif
 
-void config_init(void) {
-  spin_lock_init(&config_lock);
-  config_clr();
+DEFINE_STATIC_KEY_FALSE(smoothing_key);
+DEFINE_STATIC_KEY_FALSE(loopback_key);
+DEFINE_STATIC_KEY_FALSE(single_pass_key);
+DEFINE_STATIC_KEY_FALSE(notrack_key);
+
+// count configs with a feature turned on, these may sleep
+#define feature_on(old, new, key)  do { if(!(old) && (new)) static_branch_inc(key); } while(0)
+#define feature_off(old, new, key) do { if((old) && !(new)) static_branch_dec(key); } while(0)
+
+static const char *checksum_policy_names[CHECKSUM_POLICIES] = {
+  [CHECKSUM_POLICY_TRUST]  = "trust",
+  [CHECKSUM_POLICY_VERIFY] = "verify",
+  [CHECKSUM_POLICY_ZERO]   = "zero",
+};
+
+const char *checksum_policy_name(uint8_t policy) {
+  return policy < CHECKSUM_POLICIES ? checksum_policy_names[policy] : NULL;
+}
+
+uint8_t checksum_policy_find(const char *name) {
+  uint8_t policy;
+  for(policy = 0; policy < CHECKSUM_POLICIES; policy++) {
+    if(!strcmp(checksum_policy_names[policy], name)) {
+      break;
+    }
+  }
+  return policy;
 }
 
-void config_set(struct config *cfg) {
-  spin_lock_bh(&config_lock);
-  config = *cfg;
-  spin_unlock_bh(&config_lock);
+void config_init(struct config_store *store) {
+  seqlock_init(&store->lock);
+  config_clr(store);
+}
+
+void config_destroy(struct config_store *store) {
+  feature_off(store->config.smoothing, 0, &smoothing_key);
+  feature_off(store->config.loopback, 0, &loopback_key);
+  feature_off(store->config.single_pass, 0, &single_pass_key);
+  feature_off(store->config.notrack, 0, &notrack_key);
+  store->config.smoothing = 0;
+  store->config.loopback = 0;
+  store->config.single_pass = 0;
+  store->config.notrack = 0;
+}
+
+// writers are serialized by the caller, so the config can be read unlocked
+void config_set(struct config_store *store, struct config *cfg) {
+  struct config old = store->config;
+
+  // turn features on before the config uses them, and off afterwards
+  feature_on(old.smoothing, cfg->smoothing, &smoothing_key);
+  feature_on(old.loopback, cfg->loopback, &loopback_key);
+  feature_on(old.single_pass, cfg->single_pass, &single_pass_key);
+  feature_on(old.notrack, cfg->notrack, &notrack_key);
+
+  write_seqlock_bh(&store->lock);
+  store->config = *cfg;
+  store->config.generation = ++store->generation;
+  write_sequnlock_bh(&store->lock);
+
+  feature_off(old.smoothing, cfg->smoothing, &smoothing_key);
+  feature_off(old.loopback, cfg->loopback, &loopback_key);
+  feature_off(old.single_pass, cfg->single_pass, &single_pass_key);
+  feature_off(old.notrack, cfg->notrack, &notrack_key);
 
   config_print(cfg);
 }
 
-void config_get(struct config *cfg) {
-  spin_lock_bh(&config_lock);
-  *cfg = config;
-  spin_unlock_bh(&config_lock);
+void config_get(struct config_store *store, struct config *cfg) {
+  unsigned seq;
+  do {
+    seq = read_seqbegin(&store->lock);
+    *cfg = store->config;
+  } while(read_seqretry(&store->lock, seq));
 }
 
-void config_clr(void) {
+void config_clr(struct config_store *store) {
   empty_struct(config, cfg);
   cfg.smoothing = 1;
   cfg.loopback = 1;
-  config_set(&cfg);
+  write_seqlock_bh(&store->lock);
+  memset(store->realms, 0, sizeof(store->realms));
+  write_sequnlock_bh(&store->lock);
+  config_set(store, &cfg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// realms, each change of a realm is a new config generation as well
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// must be called with the config lock held or in a read section, returns an
+// index into realms
+static int realm_lookup(struct config_store *store, const char *name) {
+  int i;
+  for(i = 0; i < MAX_REALMS; i++) {
+    if(store->realms[i].name[0] && !strncmp(store->realms[i].name, name, REALM_NAME_LEN)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+uint8_t realm_set(struct config_store *store, const char *name, struct in6_addr int_proxy_addr, struct in6_addr ext_proxy_addr) {
+  int i;
+  if(!name[0]) {
+    return 0;
+  }
+  write_seqlock_bh(&store->lock);
+  i = realm_lookup(store, name);
+  if(i < 0) {
+    for(i = 0; i < MAX_REALMS && store->realms[i].name[0]; i++);
+  }
+  if(i < MAX_REALMS) {
+    strncpy(store->realms[i].name, name, REALM_NAME_LEN - 1);
+    store->realms[i].int_proxy_addr = int_proxy_addr;
+    store->realms[i].ext_proxy_addr = ext_proxy_addr;
+    store->config.generation = ++store->generation;
+  }
+  write_sequnlock_bh(&store->lock);
+  return i < MAX_REALMS ? i + 1 : 0;
+}
+
+uint8_t realm_find(struct config_store *store, const char *name) {
+  unsigned seq;
+  int i;
+  do {
+    seq = read_seqbegin(&store->lock);
+    i = realm_lookup(store, name);
+  } while(read_seqretry(&store->lock, seq));
+  return i + 1;
+}
+
+bool realm_get(struct config_store *store, uint8_t id, struct realm *realm) {
+  bool found = false;
+  if(id && id <= MAX_REALMS) {
+    unsigned seq;
+    do {
+      seq = read_seqbegin(&store->lock);
+      *realm = store->realms[id - 1];
+    } while(read_seqretry(&store->lock, seq));
+    found = realm->name[0];
+  }
+  return found;
 }
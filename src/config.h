@@ -18,21 +18,98 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
+#ifdef __KERNEL__
+#include <linux/jump_label.h>
+#include <linux/seqlock.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 3, 0)
+#define DEFINE_STATIC_KEY_FALSE(name)  struct static_key name = STATIC_KEY_INIT_FALSE
+#define DECLARE_STATIC_KEY_FALSE(name) extern struct static_key name
+#define static_branch_unlikely(key)    static_key_false(key)
+#define static_branch_inc(key)         static_key_slow_inc(key)
+#define static_branch_dec(key)         static_key_slow_dec(key)
+#endif
+#endif
+
 #include "module.h"
 
+#include "addr.h"
+
+// what happens to the UDP checksums of proxied packets: trust the ingress,
+// verify them in software where the device did not and drop bad packets, or
+// send packets without UDP checksum (IPv4 only, IPv6 packets keep theirs)
+enum { CHECKSUM_POLICY_TRUST, CHECKSUM_POLICY_VERIFY, CHECKSUM_POLICY_ZERO, CHECKSUM_POLICIES, };
+
 struct config {
-  __be32 int_proxy_addr;
-  __be32 ext_proxy_addr;
+  struct in6_addr int_proxy_addr;
+  struct in6_addr ext_proxy_addr;
   uint8_t smoothing;
   uint8_t loopback;
+  uint8_t single_pass; // rewrite and transmit relayed packets in PRE_ROUTING
+  uint8_t checksum; // checksum policy
+  uint8_t notrack; // mark packets of sessions untracked, conntrack skips them
+  uint32_t idle_timeout; // seconds without packets until a session expires, 0 for never
+  uint32_t generation; // changes with every config_set
+};
+
+// a named pair of proxy addresses sessions can take theirs from, realms are
+// identified by 1..MAX_REALMS, 0 stands for no realm
+#define MAX_REALMS     16
+#define REALM_NAME_LEN 16
+
+struct realm {
+  char name[REALM_NAME_LEN];
+  struct in6_addr int_proxy_addr;
+  struct in6_addr ext_proxy_addr;
+};
+
+// the config and realms of one proxy instance, readers do not lock, they
+// retry if a writer got in between
+struct config_store {
+  seqlock_t lock;
+  struct config config;
+  uint32_t generation;
+  struct realm realms[MAX_REALMS];
 };
 
-void config_init(void);
+// enabled as long as any config has smoothing, loopback, single pass or
+// notrack turned on, so the hooks skip features nobody uses without even
+// loading the config
+DECLARE_STATIC_KEY_FALSE(smoothing_key);
+DECLARE_STATIC_KEY_FALSE(loopback_key);
+DECLARE_STATIC_KEY_FALSE(single_pass_key);
+DECLARE_STATIC_KEY_FALSE(notrack_key);
+
+#define smoothing_enabled()   static_branch_unlikely(&smoothing_key)
+#define loopback_enabled()    static_branch_unlikely(&loopback_key)
+#define single_pass_enabled() static_branch_unlikely(&single_pass_key)
+#define notrack_enabled()     static_branch_unlikely(&notrack_key)
+
+// name of a checksum policy, NULL for none
+const char *checksum_policy_name(uint8_t policy);
+
+// checksum policy called name, or CHECKSUM_POLICIES if there is none
+uint8_t checksum_policy_find(const char *name);
+
+void config_init(struct config_store *store);
+
+// drop the features of the config from the static keys, must be called
+// before the store is freed, may sleep
+void config_destroy(struct config_store *store);
+
+void config_get(struct config_store *store, struct config *cfg);
+
+// may sleep
+void config_set(struct config_store *store, struct config *cfg);
+
+void config_clr(struct config_store *store);
 
-void config_get(struct config *cfg);
+// create or update a realm, returns its id or 0 if there is no space left
+uint8_t realm_set(struct config_store *store, const char *name, struct in6_addr int_proxy_addr, struct in6_addr ext_proxy_addr);
 
-void config_set(struct config *cfg);
+// returns the id of the realm called name, or 0 if there is none
+uint8_t realm_find(struct config_store *store, const char *name);
 
-void config_clr(void);
+bool realm_get(struct config_store *store, uint8_t id, struct realm *realm);
 
 #endif // _CONFIG_H_
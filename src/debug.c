@@ -34,18 +34,30 @@ const char *ip_summed_toString(__u8 ip_summed) {
 }
 
 void debug_print_tuple(const char *msg,
-                       __be32 src_addr, __be16 src_port,
-                       __be32 dst_addr, __be16 dst_port) {
-  __u8 src_addr_ip[4] = htoal(ntohl(src_addr));
-  __u8 dst_addr_ip[4] = htoal(ntohl(dst_addr));
-  printk(BANNER "%s "IP_PORT_FMT" -> " IP_PORT_FMT"\n",
+                       struct in6_addr src_addr, __be16 src_port,
+                       struct in6_addr dst_addr, __be16 dst_port) {
+  char src_addr_ip[ADDR_STR_SIZE];
+  char dst_addr_ip[ADDR_STR_SIZE];
+  printk(BANNER "%s %s:"PORT_FMT" -> %s:"PORT_FMT"\n",
          msg,
-         src_addr_ip[0], src_addr_ip[1], src_addr_ip[2], src_addr_ip[3], ntohs(src_port),
-         dst_addr_ip[0], dst_addr_ip[1], dst_addr_ip[2], dst_addr_ip[3], ntohs(dst_port));
+         addr_str(src_addr_ip, src_addr), ntohs(src_port),
+         addr_str(dst_addr_ip, dst_addr), ntohs(dst_port));
+}
+
+static void debug_print_skb_layout(struct sk_buff *skb) {
+  printk(BANNER " data:%lu tail:%lu end:%lu nh:%lu th:%lu ip_summed:%s csum_start:"U16_FMT" csum_offset:"U16_FMT"\n",
+         skb->data - skb->head,
+         skb_tail_pointer(skb) - skb->head,
+         skb_end_pointer(skb) - skb->head,
+         skb_network_header(skb) - skb->head,
+         skb_transport_header(skb) - skb->head,
+         ip_summed_toString(skb->ip_summed),
+         skb->csum_start,
+         skb->csum_offset);
 }
 
 void debug_print_skb(const char *msg, struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header) {
-  debug_print_tuple(msg, S_ADDR, S_PORT, D_ADDR, D_PORT);
+  debug_print_tuple(msg, addr_v4(S_ADDR), S_PORT, addr_v4(D_ADDR), D_PORT);
 
   printk(BANNER " id:%hu ttl:%hhu ip_csum:"CSUM_FMT" udp_csum:"CSUM_FMT" dev:%s dst:%p\n",
          ntohs(ip_header->id),
@@ -55,14 +67,18 @@ void debug_print_skb(const char *msg, struct sk_buff *skb, struct iphdr *ip_head
          skb->dev->name,
          skb_dst(skb));
 
-  printk(BANNER " data:%lu tail:%lu end:%lu nh:%lu th:%lu ip_summed:%s csum_start:"U16_FMT" csum_offset:"U16_FMT"\n",
-         skb->data - skb->head,
-         skb_tail_pointer(skb) - skb->head,
-         skb_end_pointer(skb) - skb->head,
-         skb_network_header(skb) - skb->head,
-         skb_transport_header(skb) - skb->head,
-         ip_summed_toString(skb->ip_summed),
-         skb->csum_start,
-         skb->csum_offset);
+  debug_print_skb_layout(skb);
+}
+
+void debug_print_skb6(const char *msg, struct sk_buff *skb, struct ipv6hdr *ip6_header, struct udphdr *udp_header) {
+  debug_print_tuple(msg, ip6_header->saddr, S_PORT, ip6_header->daddr, D_PORT);
+
+  printk(BANNER " hop_limit:%hhu udp_csum:"CSUM_FMT" dev:%s dst:%p\n",
+         ip6_header->hop_limit,
+         ntohs(udp_header->check),
+         skb->dev ? skb->dev->name : "",
+         skb_dst(skb));
+
+  debug_print_skb_layout(skb);
 }
 #endif
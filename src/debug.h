@@ -22,19 +22,23 @@
 
 #ifdef __KERNEL__
 #include <linux/ip.h>
+#include <linux/ipv6.h>
 #include <linux/udp.h>
 #endif
 
 #include "module.h"
+#include "addr.h"
 
 const char *ip_summed_toString(__u8 ip_summed);
 
 void debug_print_tuple(const char *msg,
-                 __be32 src_addr, __be16 src_port,
-                 __be32 dst_addr, __be16 dst_port);
+                 struct in6_addr src_addr, __be16 src_port,
+                 struct in6_addr dst_addr, __be16 dst_port);
 
 void debug_print_skb(const char *msg, struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header);
 
+void debug_print_skb6(const char *msg, struct sk_buff *skb, struct ipv6hdr *ip6_header, struct udphdr *udp_header);
+
 #define debug_printk(fmt, ...) printk(fmt, ##__VA_ARGS__)
 
 #else
@@ -42,6 +46,7 @@ void debug_print_skb(const char *msg, struct sk_buff *skb, struct iphdr *ip_head
 #define ip_summed_toString(ip_summed) (void *)0
 #define debug_print_tuple(msg, src_addr, src_port, dst_addr, dst_port) do {} while(0)
 #define debug_print_skb(msg, skb, ip_header, udp_header) do {} while(0)
+#define debug_print_skb6(msg, skb, ip6_header, udp_header) do {} while(0)
 #define debug_printk(fmt, ...) do {} while(0)
 
 #endif
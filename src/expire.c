@@ -0,0 +1,116 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "expire.h"
+
+#include "netns.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// idle session expiry
+//
+// The hooks record the jiffies of the last packet of each session, a delayed
+// work of every namespace removes the sessions idle for longer than the
+// configured timeout and queues them for userspace to read from the
+// <module>_expired proc file.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void expire_push_function(__be16 index, struct table_entry *entry, void *arg) {
+  struct expire *expire = arg;
+  spin_lock_bh(&expire->lock);
+  expire->queue[expire->tail % EXPIRED_QUEUE_SIZE].index = index;
+  expire->queue[expire->tail % EXPIRED_QUEUE_SIZE].int_proxy_addr = entry->int_proxy_addr;
+  expire->tail++;
+  if(expire->tail - expire->head > EXPIRED_QUEUE_SIZE) {
+    expire->head++; // drop the oldest
+  }
+  spin_unlock_bh(&expire->lock);
+}
+
+// the idle timeout in jiffies, large ones are clamped to the longest time
+// the jiffies comparisons can tell
+static inline unsigned long timeout_jiffies(uint32_t idle_timeout) {
+  return min_t(unsigned long, idle_timeout, MAX_JIFFY_OFFSET / HZ) * HZ;
+}
+
+static void expire_work_function(struct work_struct *work) {
+  struct expire *expire = container_of(to_delayed_work(work), struct expire, work);
+  struct rtp_proxy_net *proxy = container_of(expire, struct rtp_proxy_net, expire);
+  struct rtp_proxy_instance *instance;
+  struct config cfg;
+  mutex_lock(&proxy->lock);
+  instance = proxy_live_locked(proxy);
+  config_get(&instance->config, &cfg);
+  if(cfg.idle_timeout) {
+    if(table_expire(&instance->table, jiffies, timeout_jiffies(cfg.idle_timeout), expire_push_function, expire)) {
+      wake_up_interruptible(&expire->wait);
+    }
+    // runs again for as long as there is a timeout, see expire_update()
+    schedule_delayed_work(&expire->work, EXPIRE_INTERVAL);
+  }
+  mutex_unlock(&proxy->lock);
+}
+
+void expire_start(struct expire *expire) {
+  spin_lock_init(&expire->lock);
+  init_waitqueue_head(&expire->wait);
+  expire->stopped = false;
+  expire->head = 0;
+  expire->tail = 0;
+  INIT_DELAYED_WORK(&expire->work, expire_work_function);
+}
+
+void expire_update(struct expire *expire) {
+  struct rtp_proxy_net *proxy = container_of(expire, struct rtp_proxy_net, expire);
+  struct config cfg;
+  config_get(&proxy_live_locked(proxy)->config, &cfg);
+  spin_lock_bh(&expire->lock);
+  if(cfg.idle_timeout && !expire->stopped) {
+    schedule_delayed_work(&expire->work, EXPIRE_INTERVAL);
+  }
+  spin_unlock_bh(&expire->lock);
+}
+
+void expire_stop(struct expire *expire) {
+  // expire_update() schedules no more, the work may still schedule itself
+  spin_lock_bh(&expire->lock);
+  expire->stopped = true;
+  spin_unlock_bh(&expire->lock);
+  cancel_delayed_work_sync(&expire->work);
+  wake_up_interruptible_all(&expire->wait);
+}
+
+bool expire_ready(struct expire *expire) {
+  bool ready;
+  spin_lock_bh(&expire->lock);
+  ready = expire->stopped || expire->head != expire->tail;
+  spin_unlock_bh(&expire->lock);
+  return ready;
+}
+
+bool expire_pop(struct expire *expire, struct expired_session *session) {
+  bool found = false;
+  spin_lock_bh(&expire->lock);
+  if(expire->head != expire->tail) {
+    *session = expire->queue[expire->head % EXPIRED_QUEUE_SIZE];
+    expire->head++;
+    found = true;
+  }
+  spin_unlock_bh(&expire->lock);
+  return found;
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _EXPIRE_H_
+#define _EXPIRE_H_
+
+#ifdef __KERNEL__
+#include <linux/jiffies.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#endif
+
+#include "module.h"
+#include "addr.h"
+
+// sessions are checked for expiry once per interval
+#define EXPIRE_INTERVAL HZ
+
+// expired sessions not yet read by userspace, the oldest get dropped when full
+#define EXPIRED_QUEUE_SIZE 1024
+
+struct expired_session {
+  __be16 index;
+  struct in6_addr int_proxy_addr;
+};
+
+struct expire {
+  struct delayed_work work;
+  spinlock_t lock;
+  wait_queue_head_t wait;
+  bool stopped;
+  unsigned int head; // next to read
+  unsigned int tail; // next to write
+  struct expired_session queue[EXPIRED_QUEUE_SIZE];
+};
+
+// API
+
+// prepare expiry, it is not scheduled until the live instance gets an idle
+// timeout
+void expire_start(struct expire *expire);
+
+// schedule expiry if the live instance has an idle timeout, must be called
+// with the proxy lock held whenever the live config may have changed
+void expire_update(struct expire *expire);
+
+// stop expiry and wake up all readers, must be called before the proc files
+// of the namespace are removed
+void expire_stop(struct expire *expire);
+
+// true if there are expired sessions to read or expiry was stopped
+bool expire_ready(struct expire *expire);
+
+// take the oldest expired session from the queue
+bool expire_pop(struct expire *expire, struct expired_session *session);
+
+#endif // _EXPIRE_H_
@@ -0,0 +1,157 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ingress.h"
+
+#include "netns.h"
+#include "mangle.h"
+
+#include "debug.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ingress fast path
+//
+// Packets of attached devices meet the proxy in the netdev ingress hook, ahead
+// of IP receive processing and the IPv4 netfilter hooks. The hook relays the
+// packets it can transmit in a single pass (see mangle.c), all others carry
+// on to the IPv4 hooks as if it was not there. Each attached device is held
+// until it is detached, or until it goes away and the notifier detaches it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct ingress_device {
+  struct list_head list;
+  struct net_device *dev;
+  struct nf_hook_ops ops;
+};
+
+void ingress_init(struct ingress *ingress, struct net *net) {
+  ingress->net = net;
+  INIT_LIST_HEAD(&ingress->devices);
+}
+
+static struct ingress_device *ingress_find(struct ingress *ingress, struct net_device *dev) {
+  struct ingress_device *device;
+  list_for_each_entry(device, &ingress->devices, list) {
+    if(device->dev == dev) {
+      return device;
+    }
+  }
+  return NULL;
+}
+
+static void ingress_remove(struct ingress *ingress, struct ingress_device *device) {
+#ifdef INGRESS_SUPPORTED
+  nf_unregister_net_hook(ingress->net, &device->ops);
+#endif
+  list_del(&device->list);
+  dev_put(device->dev);
+  kfree(device);
+}
+
+int ingress_attach(struct ingress *ingress, const char *name) {
+#ifdef INGRESS_SUPPORTED
+  struct ingress_device *device;
+  struct net_device *dev = dev_get_by_name(ingress->net, name);
+  int err;
+  if(!dev) {
+    return -ENODEV;
+  }
+  if(ingress_find(ingress, dev)) {
+    dev_put(dev);
+    return 0;
+  }
+  device = kzalloc(sizeof(*device), GFP_KERNEL);
+  if(!device) {
+    dev_put(dev);
+    return -ENOMEM;
+  }
+  device->dev          = dev;
+  device->ops.hook     = ingress_hook;
+  device->ops.pf       = NFPROTO_NETDEV;
+  device->ops.hooknum  = NF_NETDEV_INGRESS;
+  device->ops.priority = NF_IP_PRI_FIRST;
+  device->ops.dev      = dev;
+  err = nf_register_net_hook(ingress->net, &device->ops);
+  if(err) {
+    dev_put(dev);
+    kfree(device);
+    return err;
+  }
+  list_add(&device->list, &ingress->devices);
+  return 0;
+#else
+  return -EOPNOTSUPP;
+#endif
+}
+
+int ingress_detach(struct ingress *ingress, const char *name) {
+  struct ingress_device *device;
+  struct net_device *dev = dev_get_by_name(ingress->net, name);
+  if(!dev) {
+    return -ENODEV;
+  }
+  device = ingress_find(ingress, dev);
+  dev_put(dev);
+  if(!device) {
+    return -ENOENT;
+  }
+  ingress_remove(ingress, device);
+  return 0;
+}
+
+void ingress_clear(struct ingress *ingress) {
+  while(!list_empty(&ingress->devices)) {
+    ingress_remove(ingress, list_first_entry(&ingress->devices, struct ingress_device, list));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// device notifier: a device going away must not stay attached, the held
+// reference would block its unregistration
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int ingress_device_event(struct notifier_block *nb, unsigned long event, void *ptr) {
+  struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+  if(event == NETDEV_UNREGISTER) {
+    struct rtp_proxy_net *proxy = rtp_proxy_net(dev_net(dev));
+    struct ingress_device *device;
+    mutex_lock(&proxy->lock);
+    device = ingress_find(&proxy->ingress, dev);
+    if(device) {
+      debug_printk(BANNER "ingress: %s goes away, detaching\n", dev->name);
+      ingress_remove(&proxy->ingress, device);
+    }
+    mutex_unlock(&proxy->lock);
+  }
+  return NOTIFY_DONE;
+}
+
+static struct notifier_block ingress_notifier = {
+  .notifier_call = ingress_device_event,
+};
+
+int register_ingress_notifier(void) {
+  return register_netdevice_notifier(&ingress_notifier);
+}
+
+void unregister_ingress_notifier(void) {
+  unregister_netdevice_notifier(&ingress_notifier);
+}
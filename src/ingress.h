@@ -0,0 +1,61 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _INGRESS_H_
+#define _INGRESS_H_
+
+#ifdef __KERNEL__
+#include <linux/list.h>
+#include <linux/netdevice.h>
+#include <linux/netfilter.h>
+#include <linux/version.h>
+
+// the netdev ingress hook with per-device registration in a namespace
+#if defined(CONFIG_NETFILTER_INGRESS) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+#define INGRESS_SUPPORTED
+#endif
+#endif
+
+#include "module.h"
+
+// the devices of a namespace whose packets are relayed right from the netdev
+// ingress hook, before IP receive processing and the IPv4 hooks, changed with
+// the proxy lock held
+struct ingress {
+  struct net *net;
+  struct list_head devices;
+};
+
+// API
+
+void ingress_init(struct ingress *ingress, struct net *net);
+
+// relay packets received on the device of that name from its ingress hook
+int ingress_attach(struct ingress *ingress, const char *name);
+
+// stop relaying packets received on the device of that name
+int ingress_detach(struct ingress *ingress, const char *name);
+
+// detach from all devices
+void ingress_clear(struct ingress *ingress);
+
+// detach from devices that go away, on top of the pernet operations
+int register_ingress_notifier(void);
+
+void unregister_ingress_notifier(void);
+
+#endif // _INGRESS_H_
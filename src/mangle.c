@@ -19,142 +19,625 @@
 
 #include <linux/version.h>
 
+#if IS_ENABLED(CONFIG_NF_CONNTRACK)
+#include <net/netfilter/nf_conntrack.h>
+#endif
+
+#include "rtp_packet.h"
+#include "translate.h"
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 19, 0)
+#define skb_ensure_writable(skb, len) (skb_make_writable(skb, len) ? 0 : -ENOMEM)
+#endif
+
+// the destination port of a UDP packet, read without touching the skb data
+// layout, fragments other than the first carry no UDP header
+static inline bool get_udp_dest(struct sk_buff *skb, __be16 *dest) {
+  const struct iphdr *ip_header = ip_hdr(skb);
+  struct udphdr _udp_header;
+  const struct udphdr *udp_header;
+  if(ip_header->protocol != IPPROTO_UDP || (ip_header->frag_off & htons(IP_OFFSET))) {
+    return false;
+  }
+  udp_header = skb_header_pointer(skb, skb_network_offset(skb) + ip_hdrlen(skb), sizeof(_udp_header), &_udp_header);
+  if(!udp_header) {
+    return false;
+  }
+  *dest = udp_header->dest;
+  return true;
+}
+
+// the same for IPv6 packets without extension headers
+static inline bool get_udp6_dest(struct sk_buff *skb, __be16 *dest) {
+  struct udphdr _udp_header;
+  const struct udphdr *udp_header;
+  if(ipv6_hdr(skb)->nexthdr != IPPROTO_UDP) {
+    return false;
+  }
+  udp_header = skb_header_pointer(skb, skb_network_offset(skb) + sizeof(struct ipv6hdr), sizeof(_udp_header), &_udp_header);
+  if(!udp_header) {
+    return false;
+  }
+  *dest = udp_header->dest;
+  return true;
+}
+
+// give a batch shared with a clone, or with pages of others, its own copy of
+// the data without linearizing it: the head gets uncloned and the pages get
+// copied to pages of its own. Segments are rarely larger than a page, so
+// nearly every page holds an RTP header to rewrite, copying only those would
+// copy about the same. Segments on a frag list still get linearized.
+static inline bool unshare_udp_batch(struct sk_buff *skb) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 18, 0)
+  if(skb_has_frag_list(skb)) {
+    return !skb_ensure_writable(skb, skb->len);
+  }
+  if(skb_copy_ubufs(skb, GFP_ATOMIC)) {
+    return false;
+  }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+  skb_shinfo(skb)->flags &= ~SKBFL_SHARED_FRAG;
+#else
+  skb_shinfo(skb)->tx_flags &= ~SKBTX_SHARED_FRAG;
+#endif
+#endif
+  return true;
+}
+
+// make the IP and UDP headers and the RTP fixed header linear and writable,
+// leaving the payload where it is, even if it is paged, the UDP header starts
+// at offset
+static inline bool get_udp_header(struct sk_buff *skb, unsigned int offset, struct udphdr **udp_header_out) {
+  unsigned int payload;
+  struct udphdr *udp_header;
+  // smoothing writes the RTP headers of all segments of a batch where they
+  // are, the paged ones only belong to the batch if it is not shared
+  if(smoothing_enabled() && is_udp_batch(skb) && (skb_cloned(skb) || skb_has_shared_frag(skb))) {
+    if(!unshare_udp_batch(skb)) {
+      return false;
+    }
+  }
+  if(skb_ensure_writable(skb, offset + sizeof(struct udphdr))) {
+    return false;
+  }
+  udp_header = (struct udphdr *)(skb->data + offset);
+  payload = ntohs(udp_header->len);
+  if(payload < sizeof(struct udphdr)) {
+    return false;
+  }
+  payload -= sizeof(struct udphdr);
+  if(payload > sizeof(struct rtp_packet)) {
+    payload = sizeof(struct rtp_packet);
+  }
+  if(skb_ensure_writable(skb, offset + sizeof(struct udphdr) + payload)) {
+    return false;
+  }
+  // pulling may have moved the headers
+  *udp_header_out = (struct udphdr *)(skb->data + offset);
+  return true;
+}
+
 static inline bool get_ip_and_udp_headers(struct sk_buff *skb, struct iphdr **ip_header_out, struct udphdr **udp_header_out) {
-  if(skb) {
-    if(!skb_linearize(skb)) {
-      struct iphdr *ip_header = (struct iphdr *)skb_network_header(skb);
-      if(ip_header) {
-        if (ip_header->protocol == IPPROTO_UDP) {
-          struct udphdr *udp_header = (struct udphdr *)skb_transport_header(skb);
-          if(udp_header) {
-            if(ip_header_out) {
-              *ip_header_out = ip_header;
-            }
-            if(udp_header_out) {
-              *udp_header_out = udp_header;
-            }
-            return true;
-          }
-        }
+  if(!get_udp_header(skb, skb_network_offset(skb) + ip_hdrlen(skb), udp_header_out)) {
+    return false;
+  }
+  *ip_header_out = ip_hdr(skb);
+  return true;
+}
+
+static inline bool get_ip6_and_udp_headers(struct sk_buff *skb, struct ipv6hdr **ip6_header_out, struct udphdr **udp_header_out) {
+  if(!get_udp_header(skb, skb_network_offset(skb) + sizeof(struct ipv6hdr), udp_header_out)) {
+    return false;
+  }
+  *ip6_header_out = ipv6_hdr(skb);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// NOTRACK: keep conntrack away from the packets of sessions
+////////////////////////////////////////////////////////////////////////////////
+
+// mark a packet untracked like the NOTRACK target does, the PRE_ROUTING and
+// LOCAL_OUT hooks run before conntrack looks at it
+static inline void notrack(struct sk_buff *skb) {
+#if IS_ENABLED(CONFIG_NF_CONNTRACK)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 12, 0)
+  if(!skb_nfct(skb)) {
+    nf_ct_set(skb, NULL, IP_CT_UNTRACKED);
+  }
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+  if(!skb_nfct(skb)) {
+    nf_ct_set(skb, nf_ct_untracked_get(), IP_CT_NEW);
+    nf_conntrack_get(skb_nfct(skb));
+  }
+#else
+  if(!skb->nfct) {
+    skb->nfct = &nf_ct_untracked_get()->ct_general;
+    skb->nfctinfo = IP_CT_NEW;
+    nf_conntrack_get(skb->nfct);
+  }
+#endif
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SINGLE PASS: rewrite completely and transmit in PRE_ROUTING
+////////////////////////////////////////////////////////////////////////////////
+
+// whether the packet, or any segment of a batch, does not fit the route
+static inline bool exceeds_mtu(struct sk_buff *skb, unsigned int mtu) {
+  if(skb->len <= mtu) {
+    return false;
+  }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+  if(is_udp_batch(skb)) {
+    return !skb_gso_validate_network_len(skb, mtu);
+  }
+#endif
+  return true;
+}
+
+// returns false if the packet has to take the normal path, which also takes
+// care of expiring TTLs, fragmentation and GSO other than UDP batches
+static bool single_pass(struct net *net, struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header, struct routing *rt) {
+  struct relay_target target;
+  struct dst_entry *dst;
+  if(!rt->own_state || ip_header->ttl <= 1 || (skb_is_gso(skb) && !is_udp_batch(skb)) ||
+     !get_relay_target(ip_header, udp_header, rt, &target)) {
+    return false;
+  }
+  dst = route_output(&rt->own_state->routes, target.direction, net, target.saddr, target.daddr);
+  if(!dst || container_of(dst, struct rtable, dst)->rt_type != RTN_UNICAST || exceeds_mtu(skb, dst_mtu(dst))) {
+    return false;
+  }
+  single_pass_udp_packet(skb, ip_header, udp_header, rt, &target);
+  ip_decrease_ttl(ip_header);
+  skb_dst_drop(skb);
+  skb_dst_set_noref(skb, dst);
+  route_transmit(net, skb);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TRANSLATION: relay interworking sessions to the other IP version in
+// PRE_ROUTING
+////////////////////////////////////////////////////////////////////////////////
+
+#if IS_ENABLED(CONFIG_IPV6)
+// NF_ACCEPT if the packet keeps its IP version, otherwise it gets translated
+// and sent, or dropped
+static unsigned int translate(struct net *net, struct sk_buff *skb, struct in6_addr saddr, struct in6_addr daddr,
+                              struct udphdr *udp_header, struct routing *rt) {
+  struct translate_target target;
+  bool translated;
+  if(!get_translate_target(saddr, daddr, udp_header, rt, &target)) {
+    return NF_ACCEPT;
+  }
+  if(skb_is_gso(skb)) {
+    debug_printk(BANNER " GSO packet cannot be translated -> DROP\n");
+    return NF_DROP;
+  }
+  translate_udp_packet(skb, udp_header, rt, &target);
+  if(addr_is_v4(target.daddr)) {
+    translated = translate_to_ipv4(skb, addr_to_v4(target.saddr), addr_to_v4(target.daddr));
+  }
+  else {
+    translated = translate_to_ipv6(skb, target.saddr, target.daddr);
+  }
+  if(!translated || !translate_output(net, skb)) {
+    debug_printk(BANNER " packet could not be translated -> DROP\n");
+    return NF_DROP;
+  }
+  return NF_STOLEN;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// INGRESS: relay in a single pass from the netdev ingress hook
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef INGRESS_SUPPORTED
+// check the IP header of a received packet the way IP receive processing
+// does, which has not seen it yet, only unfragmented packets without options
+// qualify
+static bool ingress_ip_header(struct sk_buff *skb) {
+  const struct iphdr *ip_header = ip_hdr(skb);
+  unsigned int len = ntohs(ip_header->tot_len);
+  if(ip_is_fragment(ip_header) || ip_fast_csum((u8 *)ip_header, ip_header->ihl) ||
+     len < sizeof(struct iphdr) || skb->len < len || pskb_trim_rcsum(skb, len)) {
+    return false;
+  }
+  skb_set_transport_header(skb, sizeof(struct iphdr));
+  memset(IPCB(skb), 0, sizeof(struct inet_skb_parm));
+  return true;
+}
+
+// required by ingress.c
+unsigned int ingress_hook(void *priv, struct sk_buff *skb, const struct nf_hook_state *state) {
+  struct net *net = state->net;
+  struct rtp_proxy_instance *instance;
+  struct iphdr *ip_header;
+  struct udphdr *udp_header;
+  __be16 dest;
+  // the fast path relays in a single pass only
+  if(!sessions_exist() || !single_pass_enabled() ||
+     skb->protocol != htons(ETH_P_IP) || skb->pkt_type != PACKET_HOST ||
+     skb_shared(skb) || !pskb_may_pull(skb, sizeof(struct iphdr))) {
+    return NF_ACCEPT;
+  }
+  ip_header = ip_hdr(skb);
+  if(ip_header->version != 4 || ip_header->ihl != 5 || !get_udp_dest(skb, &dest)) {
+    return NF_ACCEPT;
+  }
+  instance = proxy_live(rtp_proxy_net(net));
+  if(table_has(&instance->table, dest) && ingress_ip_header(skb) &&
+     get_ip_and_udp_headers(skb, &ip_header, &udp_header)) {
+    struct config cfg;
+    struct table_entry ent;
+    struct routing rt;
+    config_get(&instance->config, &cfg);
+    if(cfg.single_pass &&
+       get_routing(&instance->table, udp_header->dest, addr_v4(D_ADDR), addr_v4(S_ADDR), udp_header->source,
+                   &cfg, &ent, &rt)) {
+      table_touch(&rt, jiffies);
+      debug_print_skb("INGRESS     ", skb, ip_header, udp_header);
+      if(!handle_incoming_checksums(skb, NF_IP_PRE_ROUTING, ip_header, udp_header, cfg.checksum)) {
+        return NF_DROP;
+      }
+      if(single_pass(net, skb, ip_header, udp_header, &rt)) {
+        return NF_STOLEN;
       }
     }
   }
-  return false;
+  // the IPv4 hooks take care of it
+  return NF_ACCEPT;
 }
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
-// GENERIC HOOK FUNCTION
+// LOCAL_OUT: route again after changing the destination
 ////////////////////////////////////////////////////////////////////////////////
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0)
-static unsigned int generic_hook_func(const struct nf_hook_ops *ops,
-                                      struct sk_buff *skb,
-                                      const struct net_device *_in,
-                                      const struct net_device *_out,
-                                      const struct nf_hook_state *state) {
-  struct mangle_hook *mangle_hook = ops->priv;
+// take the route from the route cache of the session, unless a mark or a bound
+// socket ask for a route of their own
+static int local_out_route(struct net *net, const struct nf_hook_state *state, struct sk_buff *skb,
+                           struct iphdr *ip_header, struct udphdr *udp_header, struct routing *rt) {
+  struct relay_target target;
+  if(rt->own_state && !skb->mark && !(skb->sk && skb->sk->sk_bound_dev_if) &&
+     get_relay_target(ip_header, udp_header, rt, &target) && target.daddr == D_ADDR) {
+    struct dst_entry *dst = route_output(&rt->own_state->routes, target.direction, net, target.saddr, target.daddr);
+    if(dst) {
+      // the packet may leave the RCU read side critical section of the hook
+      skb_dst_drop(skb);
+      skb_dst_set(skb, dst_clone(dst));
+      return 0;
+    }
+  }
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0)
+  return ip_route_me_harder(skb, RTN_UNSPEC);
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(5, 4, 78)
+  return ip_route_me_harder(net, skb, RTN_UNSPEC);
 #else
-static unsigned int generic_hook_func(void *priv,
-                                      struct sk_buff *skb,
-                                      const struct nf_hook_state *state) {
-  struct mangle_hook *mangle_hook = priv;
-#endif
-  if(mangle_hook) {
-    if(mangle_hook->name) {
-      struct iphdr *ip_header;
-      struct udphdr *udp_header;
-      if(get_ip_and_udp_headers(skb, &ip_header, &udp_header)) {
-        if(mangle_hook->fn) {
-          // get internal/external proxy IPs from config
-          struct config cfg;
-          config_get(&cfg);
-          {
-            // lookup entry for destination port of incoming UDP packet
-            __be16 index = udp_header->dest;
-            struct table_entry ent;
-            struct routing rt;
-            // if entry is found
-            if(get_routing(index, &cfg, &ent, &rt)) {
-              debug_print_skb(mangle_hook->name, skb, ip_header, udp_header);
-              if(state->hook == NF_IP_PRE_ROUTING || state->hook == NF_IP_LOCAL_OUT) {
-                handle_incoming_checksums(skb, ip_header, udp_header);
-              }
-              switch(mangle_hook->fn(ip_header, udp_header, &ent, &rt)) {
-              case NF_ACCEPT:
-                if(state->hook == NF_IP_LOCAL_OUT) {
+  return ip_route_me_harder(net, state->sk, skb, RTN_UNSPEC);
+#endif
+}
+
+#if IS_ENABLED(CONFIG_IPV6)
+// IPv6 sessions always route again, they have no route cache
+static int local_out_route6(struct net *net, const struct nf_hook_state *state, struct sk_buff *skb) {
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0)
-                  int err = ip_route_me_harder(skb, RTN_UNSPEC);
+  return ip6_route_me_harder(skb);
 #elif LINUX_VERSION_CODE < KERNEL_VERSION(5, 4, 78)
-                  int err = ip_route_me_harder(state->net, skb, RTN_UNSPEC);
+  return ip6_route_me_harder(net, skb);
 #else
-                  int err = ip_route_me_harder(state->net, state->sk, skb, RTN_UNSPEC);
-#endif
-                  if (err < 0) {
-                    debug_printk(BANNER " ip_route_me_harder FAILED -> DROP\n");
-                    return NF_DROP_ERR(err);
-                  }
-                }
-                else if(state->hook == NF_IP_POST_ROUTING) {
-                  handle_outgoing_checksums(skb, ip_header, udp_header);
-                }
-                return NF_ACCEPT;
-              case NF_DROP:
-                debug_printk(BANNER " packet could not be routed -> DROP\n");
-                return NF_DROP;
-              }
+  return ip6_route_me_harder(net, state->sk, skb);
+#endif
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// GENERIC HOOK FUNCTION
+//
+// always inlined into one function per hook, with the hook number and the
+// rewrite function known at compile time: the rewrite is a direct call, and
+// the steps of other hooks are left out
+////////////////////////////////////////////////////////////////////////////////
+
+static __always_inline unsigned int hook_func(struct mangle_hook *mangle_hook,
+                                              struct net *net,
+                                              struct sk_buff *skb,
+                                              const struct nf_hook_state *state,
+                                              const unsigned int hooknum,
+                                              mangle_hook_fn *fn) {
+  struct rtp_proxy_net *proxy = rtp_proxy_net(net);
+  struct rtp_proxy_instance *instance;
+  struct iphdr *ip_header;
+  struct udphdr *udp_header;
+  __be16 dest;
+  // nothing to do while no table holds sessions
+  if(!sessions_exist()) {
+    return NF_ACCEPT;
+  }
+  // packets relayed in a single pass or translated from IPv6 are rewritten
+  // already, and the rewritten destination port may be a proxied port as well
+  if(hooknum == NF_IP_POST_ROUTING && route_transmitting()) {
+    return NF_ACCEPT;
+  }
+  // let packets of other than the proxied ports pass before touching their data
+  if(!skb || !get_udp_dest(skb, &dest)) {
+    return NF_ACCEPT;
+  }
+  instance = proxy_live(proxy);
+  if(!table_has(&instance->table, dest)) {
+    return NF_ACCEPT;
+  }
+  if(get_ip_and_udp_headers(skb, &ip_header, &udp_header)) {
+    // get internal/external proxy IPs from config
+    struct config cfg;
+    config_get(&instance->config, &cfg);
+    {
+      // lookup entry for destination port of incoming UDP packet
+      __be16 index = udp_header->dest;
+      struct table_entry ent;
+      struct routing rt;
+      // if entry is found
+      if(get_routing(&instance->table, index, addr_v4(D_ADDR), addr_v4(S_ADDR), udp_header->source,
+                     &cfg, &ent, &rt)) {
+        table_touch(&rt, jiffies);
+        debug_print_skb(mangle_hook->name, skb, ip_header, udp_header);
+        if(hooknum == NF_IP_PRE_ROUTING || hooknum == NF_IP_LOCAL_OUT) {
+          if(!handle_incoming_checksums(skb, hooknum, ip_header, udp_header, cfg.checksum)) {
+            return NF_DROP;
+          }
+          if(notrack_enabled() && cfg.notrack) {
+            notrack(skb);
+          }
+        }
+#if IS_ENABLED(CONFIG_IPV6)
+        if(hooknum == NF_IP_PRE_ROUTING && rt.interworking) {
+          unsigned int verdict = translate(net, skb, addr_v4(S_ADDR), addr_v4(D_ADDR), udp_header, &rt);
+          if(verdict != NF_ACCEPT) {
+            return verdict;
+          }
+        }
+#endif
+        if(hooknum == NF_IP_PRE_ROUTING && single_pass_enabled() && cfg.single_pass &&
+           single_pass(net, skb, ip_header, udp_header, &rt)) {
+          return NF_STOLEN;
+        }
+        switch(fn(skb, ip_header, udp_header, &ent, &rt)) {
+        case NF_ACCEPT:
+          if(hooknum == NF_IP_LOCAL_OUT) {
+            int err = local_out_route(net, state, skb, ip_header, udp_header, &rt);
+            if (err < 0) {
+              debug_printk(BANNER " local_out_route FAILED -> DROP\n");
+              return NF_DROP_ERR(err);
             }
           }
+          return NF_ACCEPT;
+        case NF_DROP:
+          debug_printk(BANNER " packet could not be routed -> DROP\n");
+          return NF_DROP;
+        }
+      }
+    }
+  }
+  return NF_ACCEPT;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0)
+#define HOOK_FUNCTION(name, hooknum, fn)                                                      \
+  static unsigned int name(const struct nf_hook_ops *ops,                                     \
+                           struct sk_buff *skb,                                               \
+                           const struct net_device *_in,                                      \
+                           const struct net_device *_out,                                     \
+                           const struct nf_hook_state *state) {                               \
+    return hook_func(ops->priv, dev_net(_in ? _in : _out), skb, state, hooknum, fn);          \
+  }
+#else
+#define HOOK_FUNCTION(name, hooknum, fn)                                                      \
+  static unsigned int name(void *priv,                                                        \
+                           struct sk_buff *skb,                                               \
+                           const struct nf_hook_state *state) {                               \
+    return hook_func(priv, state->net, skb, state, hooknum, fn);                              \
+  }
+#endif
+
+HOOK_FUNCTION(pre_routing_hook,  NF_IP_PRE_ROUTING,  pre_route_udp_packet)
+HOOK_FUNCTION(local_in_hook,     NF_IP_LOCAL_IN,     local_in_udp_packet)
+HOOK_FUNCTION(local_out_hook,    NF_IP_LOCAL_OUT,    local_out_udp_packet)
+HOOK_FUNCTION(post_routing_hook, NF_IP_POST_ROUTING, post_route_udp_packet)
+
+////////////////////////////////////////////////////////////////////////////////
+// GENERIC IPv6 HOOK FUNCTION
+//
+// the same as above for UDP packets without extension headers, which take
+// the normal path through the stack in every hook, unless they get translated
+////////////////////////////////////////////////////////////////////////////////
+
+#if IS_ENABLED(CONFIG_IPV6)
+static __always_inline unsigned int hook6_func(struct mangle_hook *mangle_hook,
+                                               struct net *net,
+                                               struct sk_buff *skb,
+                                               const struct nf_hook_state *state,
+                                               const unsigned int hooknum,
+                                               mangle_hook6_fn *fn) {
+  struct rtp_proxy_net *proxy = rtp_proxy_net(net);
+  struct rtp_proxy_instance *instance;
+  struct ipv6hdr *ip6_header;
+  struct udphdr *udp_header;
+  __be16 dest;
+  if(!sessions_exist()) {
+    return NF_ACCEPT;
+  }
+  // packets translated from IPv4 are rewritten already
+  if(hooknum == NF_INET_POST_ROUTING && route_transmitting()) {
+    return NF_ACCEPT;
+  }
+  if(!skb || !get_udp6_dest(skb, &dest)) {
+    return NF_ACCEPT;
+  }
+  instance = proxy_live(proxy);
+  if(!table_has(&instance->table, dest)) {
+    return NF_ACCEPT;
+  }
+  if(get_ip6_and_udp_headers(skb, &ip6_header, &udp_header)) {
+    struct config cfg;
+    struct table_entry ent;
+    struct routing rt;
+    config_get(&instance->config, &cfg);
+    if(get_routing(&instance->table, udp_header->dest, ip6_header->daddr, ip6_header->saddr, udp_header->source,
+                   &cfg, &ent, &rt)) {
+      table_touch(&rt, jiffies);
+      debug_print_skb6(mangle_hook->name, skb, ip6_header, udp_header);
+      if(hooknum == NF_INET_PRE_ROUTING || hooknum == NF_INET_LOCAL_OUT) {
+        if(!handle_incoming_checksums6(skb, hooknum, udp_header, cfg.checksum)) {
+          return NF_DROP;
+        }
+        if(notrack_enabled() && cfg.notrack) {
+          notrack(skb);
+        }
+      }
+      if(hooknum == NF_INET_PRE_ROUTING && rt.interworking) {
+        unsigned int verdict = translate(net, skb, ip6_header->saddr, ip6_header->daddr, udp_header, &rt);
+        if(verdict != NF_ACCEPT) {
+          return verdict;
+        }
+      }
+      switch(fn(skb, ip6_header, udp_header, &ent, &rt)) {
+      case NF_ACCEPT:
+        if(hooknum == NF_INET_LOCAL_OUT) {
+          int err = local_out_route6(net, state, skb);
+          if (err < 0) {
+            debug_printk(BANNER " local_out_route6 FAILED -> DROP\n");
+            return NF_DROP_ERR(err);
+          }
         }
+        return NF_ACCEPT;
+      case NF_DROP:
+        debug_printk(BANNER " packet could not be routed -> DROP\n");
+        return NF_DROP;
       }
     }
   }
   return NF_ACCEPT;
 }
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0)
+#define HOOK6_FUNCTION(name, hooknum, fn)                                                     \
+  static unsigned int name(const struct nf_hook_ops *ops,                                     \
+                           struct sk_buff *skb,                                               \
+                           const struct net_device *_in,                                      \
+                           const struct net_device *_out,                                     \
+                           const struct nf_hook_state *state) {                               \
+    return hook6_func(ops->priv, dev_net(_in ? _in : _out), skb, state, hooknum, fn);         \
+  }
+#else
+#define HOOK6_FUNCTION(name, hooknum, fn)                                                     \
+  static unsigned int name(void *priv,                                                        \
+                           struct sk_buff *skb,                                               \
+                           const struct nf_hook_state *state) {                               \
+    return hook6_func(priv, state->net, skb, state, hooknum, fn);                             \
+  }
+#endif
+
+HOOK6_FUNCTION(pre_routing6_hook,  NF_INET_PRE_ROUTING,  pre_route_udp6_packet)
+HOOK6_FUNCTION(local_in6_hook,     NF_INET_LOCAL_IN,     local_in_udp6_packet)
+HOOK6_FUNCTION(local_out6_hook,    NF_INET_LOCAL_OUT,    local_out_udp6_packet)
+HOOK6_FUNCTION(post_routing6_hook, NF_INET_POST_ROUTING, post_route_udp6_packet)
+#endif
+
+// the specialized hook function of a hook, or NULL if there is none
+static nf_hookfn *specialized_hook(int pf, int hooknum) {
+  if(pf == PF_INET) {
+    switch(hooknum) {
+    case NF_IP_PRE_ROUTING:
+      return pre_routing_hook;
+    case NF_IP_LOCAL_IN:
+      return local_in_hook;
+    case NF_IP_LOCAL_OUT:
+      return local_out_hook;
+    case NF_IP_POST_ROUTING:
+      return post_routing_hook;
+    }
+  }
+#if IS_ENABLED(CONFIG_IPV6)
+  if(pf == PF_INET6) {
+    switch(hooknum) {
+    case NF_INET_PRE_ROUTING:
+      return pre_routing6_hook;
+    case NF_INET_LOCAL_IN:
+      return local_in6_hook;
+    case NF_INET_LOCAL_OUT:
+      return local_out6_hook;
+    case NF_INET_POST_ROUTING:
+      return post_routing6_hook;
+    }
+  }
+#endif
+  return NULL;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // registration and unregistration of netfilter hooks
 ////////////////////////////////////////////////////////////////////////////////
 
 static int hook_count = 0;
-static struct nf_hook_ops hook_ops[NF_MAX_HOOKS];
+static struct nf_hook_ops hook_ops[2 * NF_MAX_HOOKS]; // IPv4 and IPv6
 
-void register_nf_hooks(void) {
+// the hook ops are shared by all network namespaces
+static void init_hook_ops(void) {
   struct mangle_hook *mangle_hooks;
   hook_count = get_mangle_hooks(&mangle_hooks);
-  if(hook_count > NF_MAX_HOOKS) {
+  if(hook_count > ARRAY_SIZE(hook_ops)) {
     debug_printk(BANNER "too many hooks (%d), setting to 0", hook_count);
     hook_count = 0;
   }
   if(hook_count > 0) {
     int i;
     for(i = 0; i < hook_count; i++) {
-      hook_ops[i].hook     = generic_hook_func;
+      hook_ops[i].hook     = specialized_hook(mangle_hooks[i].pf, mangle_hooks[i].hooknum);
+      if(!hook_ops[i].hook) {
+        debug_printk(BANNER "no hook function for hook %d, setting hooks to 0", mangle_hooks[i].hooknum);
+        hook_count = 0;
+        return;
+      }
       hook_ops[i].hooknum  = mangle_hooks[i].hooknum;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0)
       hook_ops[i].owner    = THIS_MODULE;
 #endif
       hook_ops[i].priv     = &mangle_hooks[i];
-      hook_ops[i].pf       = PF_INET;
+      hook_ops[i].pf       = mangle_hooks[i].pf;
       hook_ops[i].priority = mangle_hooks[i].priority;
     }
+  }
+}
+
+int register_nf_hooks(struct net *net) {
+  if(!hook_count) {
+    init_hook_ops();
+  }
+  if(hook_count > 0) {
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0)
-    nf_register_hooks(hook_ops, hook_count);
+    // hooks are global, they get registered along with the initial namespace
+    if(net_eq(net, &init_net)) {
+      return nf_register_hooks(hook_ops, hook_count);
+    }
 #else
-    // TODO init_net might not always be appropriate
-    // https://stackoverflow.com/a/13355999
-    nf_register_net_hooks(&init_net, hook_ops, hook_count);
+    return nf_register_net_hooks(net, hook_ops, hook_count);
 #endif
   }
+  return 0;
 }
 
-void unregister_nf_hooks(void) {
+void unregister_nf_hooks(struct net *net) {
   if(hook_count > 0) {
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0)
-    nf_unregister_hooks(hook_ops, hook_count);
+    if(net_eq(net, &init_net)) {
+      nf_unregister_hooks(hook_ops, hook_count);
+    }
 #else
-    // TODO init_net might not always be appropriate
-    // https://stackoverflow.com/a/13355999
-    nf_unregister_net_hooks(&init_net, hook_ops, hook_count);
+    nf_unregister_net_hooks(net, hook_ops, hook_count);
 #endif
   }
 }
@@ -19,7 +19,18 @@
 #define _MANGLE_H_
 
 #ifdef __KERNEL__
+#include <linux/ipv6.h>
 #include <linux/netfilter_ipv4.h>
+#include <linux/netfilter_ipv6.h>
+#include <linux/skbuff.h>
+#include <linux/version.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 18, 0)
+#define SKB_GSO_UDP_L4 0
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 6, 0)
+#define SKB_GSO_FRAGLIST 0
+#endif
 #endif
 
 #include "module.h"
@@ -27,28 +38,103 @@
 
 #include "config.h"
 #include "table.h"
+#include "netns.h"
+#include "route.h"
 #include "checksum.h"
 
 // simplified nf_hookfn
-typedef unsigned int mangle_hook_fn(struct iphdr *ip_header,
+typedef unsigned int mangle_hook_fn(struct sk_buff *skb,
+                                    struct iphdr *ip_header,
                                     struct udphdr *udp_header,
                                     struct table_entry *ent,
                                     struct routing *rt);
 
+// simplified nf_hookfn of the IPv6 hooks
+typedef unsigned int mangle_hook6_fn(struct sk_buff *skb,
+                                     struct ipv6hdr *ip6_header,
+                                     struct udphdr *udp_header,
+                                     struct table_entry *ent,
+                                     struct routing *rt);
+
 // simplified nf_hook_ops
 struct mangle_hook {
+  int                pf;       // same as nf_hook_ops pf
   int                hooknum;  // same as nf_hook_ops hooknum
-  const char        *name;     // if non-NULL, interpret as UDP packet (and log hook name in DEBUG mode)
-  mangle_hook_fn    *fn;       // if also non-NULL possibly mangle UDP packet
+  const char        *name;     // hook name to log in DEBUG mode
   int                priority; // same as nf_hook_ops priority
 };
 
 // API
-void register_nf_hooks(void);
+int register_nf_hooks(struct net *net);
+
+#ifdef INGRESS_SUPPORTED
+// netdev ingress hook of the devices attached to the ingress fast path
+unsigned int ingress_hook(void *priv, struct sk_buff *skb, const struct nf_hook_state *state);
+#endif
+
+void unregister_nf_hooks(struct net *net);
+
+// where a relayed packet goes after the complete rewrite
+struct relay_target {
+  int    direction; // ROUTE_EXTERNAL or ROUTE_INTERNAL
+  __be32 saddr;
+  __be16 sport;
+  __be32 daddr;
+  __be16 dport;
+};
 
-void unregister_nf_hooks(void);
+// where a packet of an interworking session goes in the other IP version
+struct translate_target {
+  int             direction; // ROUTE_EXTERNAL or ROUTE_INTERNAL
+  struct in6_addr saddr;
+  __be16          sport;
+  struct in6_addr daddr;
+  __be16          dport;
+};
+
+// a batch of UDP datagrams of one flow merged by GRO or sent with UDP_SEGMENT:
+// the segments follow each other gso_size bytes apart behind a single IP and
+// UDP header, the UDP checksum gets computed per segment when the batch is
+// split. Batches with a list of segment skbs carry headers of their own for
+// each segment and do not qualify.
+static inline bool is_udp_batch(struct sk_buff *skb) {
+  return skb_is_gso(skb) && skb->ip_summed == CHECKSUM_PARTIAL &&
+    (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) && !(skb_shinfo(skb)->gso_type & SKB_GSO_FRAGLIST);
+}
 
 // must be defined elsewhere
 extern int get_mangle_hooks(struct mangle_hook **mangle_hooks);
 
+// must be defined elsewhere, the rewrite of each hook, called directly from
+// the hook functions
+extern mangle_hook_fn pre_route_udp_packet;
+extern mangle_hook_fn local_in_udp_packet;
+extern mangle_hook_fn local_out_udp_packet;
+extern mangle_hook_fn post_route_udp_packet;
+
+#if IS_ENABLED(CONFIG_IPV6)
+extern mangle_hook6_fn pre_route_udp6_packet;
+extern mangle_hook6_fn local_in_udp6_packet;
+extern mangle_hook6_fn local_out_udp6_packet;
+extern mangle_hook6_fn post_route_udp6_packet;
+#endif
+
+// must be defined elsewhere, false if the packet has to take the normal path
+extern bool get_relay_target(struct iphdr *ip_header, struct udphdr *udp_header,
+                             struct routing *rt, struct relay_target *sp);
+
+// must be defined elsewhere, does what PRE_ROUTING and POST_ROUTING do together
+extern void single_pass_udp_packet(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header,
+                                   struct routing *rt, struct relay_target *sp);
+
+// must be defined elsewhere, true if the packet from saddr to daddr changes
+// its IP version
+extern bool get_translate_target(struct in6_addr saddr, struct in6_addr daddr, struct udphdr *udp_header,
+                                 struct routing *rt, struct translate_target *target);
+
+// must be defined elsewhere, rewrites the ports and RTP of a packet changing
+// its IP version, before its IP header gets translated
+extern void translate_udp_packet(struct sk_buff *skb, struct udphdr *udp_header,
+                                 struct routing *rt, struct translate_target *target);
+
 #endif // _MANGLE_H_
@@ -15,10 +15,7 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include "config.h"
-#include "table.h"
-#include "procfs.h"
-#include "mangle.h"
+#include "netns.h"
 
 #ifndef VERSION
 #define VERSION "V1.0"
@@ -42,20 +39,27 @@
 static
 #endif
 int __init rtp_proxy_init(void) {
+  int err;
   printk(BANNER "init "VERSION" "MODE" [build date "__DATE__" "__TIME__"]\n");
-  config_init();
-  table_init();
-  proc_file_create();
-  register_nf_hooks();
-  return 0;
+  err = register_pernet();
+  if(err) {
+    return err;
+  }
+  err = register_ingress_notifier();
+  if(err) {
+    unregister_pernet();
+  }
+  return err;
 }
 
 #ifndef TESTS
 static
 #endif
 void __exit rtp_proxy_exit(void) {
-  unregister_nf_hooks();
-  proc_file_remove();
+  // no namespace may see the notifier once its proxy state is gone
+  unregister_ingress_notifier();
+  unregister_pernet();
+  rcu_barrier(); // wait for the callbacks freeing flushed tables
   printk(BANNER "exit\n");
 }
 
@@ -43,7 +43,7 @@
 #define CSUM_FMT "%04hx"
 
 // byte array <-> host byte order integer conversion of IP4 addresses
-#define atohl(ip) ((ip[0] << 24) | (ip[1] << 16) | (ip[2] << 8) | (ip[3] << 0))
+#define atohl(ip) (((uint32_t)ip[0] << 24) | (ip[1] << 16) | (ip[2] << 8) | (ip[3] << 0))
 #define htoal(ip) { (ip >> 24) & 0xFF, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, (ip >> 0) & 0xFF, }
 
 // create local variable "name" of type struct "type", and fill with zeros
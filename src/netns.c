@@ -0,0 +1,156 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "netns.h"
+
+#include "procfs.h"
+#include "mangle.h"
+
+static unsigned int rtp_proxy_net_id __read_mostly;
+
+struct rtp_proxy_net *rtp_proxy_net(struct net *net) {
+  return net_generic(net, rtp_proxy_net_id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// instances: commands either modify the live instance in place, or build a
+// staged one that replaces the live one at once. The replaced instance is
+// freed after a grace period, when no packet can be using it any more.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static struct rtp_proxy_instance *instance_new(void) {
+  struct rtp_proxy_instance *instance = kzalloc(sizeof(*instance), GFP_KERNEL);
+  if(instance) {
+    config_init(&instance->config);
+    table_init(&instance->table, &instance->config);
+  }
+  return instance;
+}
+
+static void instance_free_rcu(struct rcu_head *head) {
+  struct rtp_proxy_instance *instance = container_of(head, struct rtp_proxy_instance, rcu);
+  table_destroy(&instance->table);
+  kfree(instance);
+}
+
+static void instance_free(struct rtp_proxy_instance *instance) {
+  if(instance) {
+    config_destroy(&instance->config);
+    table_release(&instance->table);
+    call_rcu(&instance->rcu, instance_free_rcu);
+  }
+}
+
+struct rtp_proxy_instance *proxy_target(struct rtp_proxy_net *proxy) {
+  if(proxy->staged) {
+    return proxy->staged;
+  }
+  return proxy_live_locked(proxy);
+}
+
+bool proxy_stage(struct rtp_proxy_net *proxy) {
+  struct rtp_proxy_instance *instance = instance_new();
+  if(!instance) {
+    return false;
+  }
+  instance_free(proxy->staged);
+  proxy->staged = instance;
+  return true;
+}
+
+bool proxy_commit(struct rtp_proxy_net *proxy) {
+  struct rtp_proxy_instance *old = proxy_live_locked(proxy);
+  struct rtp_proxy_instance *instance = proxy->staged;
+  if(!instance) {
+    return false;
+  }
+  table_adopt(&instance->table, &old->table);
+  rcu_assign_pointer(proxy->live, instance);
+  proxy->staged = NULL;
+  instance_free(old);
+  return true;
+}
+
+void proxy_abort(struct rtp_proxy_net *proxy) {
+  instance_free(proxy->staged);
+  proxy->staged = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// network namespace setup and teardown
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static int __net_init rtp_proxy_net_init(struct net *net) {
+  struct rtp_proxy_net *proxy = rtp_proxy_net(net);
+  struct rtp_proxy_instance *instance = instance_new();
+  int err;
+  if(!instance) {
+    return -ENOMEM;
+  }
+  proxy->net = net;
+  mutex_init(&proxy->lock);
+  RCU_INIT_POINTER(proxy->live, instance);
+  proxy->staged = NULL;
+  ingress_init(&proxy->ingress, net);
+  expire_start(&proxy->expire);
+  err = proc_file_create(net, proxy);
+  if(err) {
+    expire_stop(&proxy->expire);
+    instance_free(instance);
+    return err;
+  }
+  err = register_nf_hooks(net);
+  if(err) {
+    expire_stop(&proxy->expire);
+    proc_file_remove(net);
+    instance_free(instance);
+    return err;
+  }
+  return 0;
+}
+
+static void __net_exit rtp_proxy_net_exit(struct net *net) {
+  struct rtp_proxy_net *proxy = rtp_proxy_net(net);
+  unregister_nf_hooks(net);
+  expire_stop(&proxy->expire);
+  proc_file_remove(net);
+  mutex_lock(&proxy->lock);
+  ingress_clear(&proxy->ingress);
+  instance_free(proxy_live_locked(proxy));
+  RCU_INIT_POINTER(proxy->live, NULL);
+  proxy_abort(proxy);
+  mutex_unlock(&proxy->lock);
+}
+
+static struct pernet_operations rtp_proxy_net_ops = {
+  .init = rtp_proxy_net_init,
+  .exit = rtp_proxy_net_exit,
+  .id   = &rtp_proxy_net_id,
+  .size = sizeof(struct rtp_proxy_net),
+};
+
+int register_pernet(void) {
+  return register_pernet_subsys(&rtp_proxy_net_ops);
+}
+
+void unregister_pernet(void) {
+  unregister_pernet_subsys(&rtp_proxy_net_ops);
+}
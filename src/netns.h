@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NETNS_H_
+#define _NETNS_H_
+
+#ifdef __KERNEL__
+#include <linux/mutex.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+#endif
+
+#include "module.h"
+
+#include "config.h"
+#include "table.h"
+#include "expire.h"
+#include "ingress.h"
+
+// config and sessions of a proxy, replaced as a whole when a staged instance
+// gets committed
+struct rtp_proxy_instance {
+  struct config_store config;
+  struct table table;
+  struct rcu_head rcu;
+};
+
+// state of the proxy in one network namespace, each namespace has its own
+// instance, session expiry, netfilter hooks, ingress devices and proc files
+struct rtp_proxy_net {
+  struct net *net;                       // the namespace it belongs to
+  struct rtp_proxy_instance __rcu *live; // the one the hooks use
+  struct rtp_proxy_instance *staged;     // being built by commands, or NULL
+  struct mutex lock;                     // serializes commands, staging and expiry
+  struct expire expire;
+  struct ingress ingress;
+};
+
+// API
+
+struct rtp_proxy_net *rtp_proxy_net(struct net *net);
+
+// the instance the hooks use, must be called in an RCU read side critical
+// section
+static inline struct rtp_proxy_instance *proxy_live(struct rtp_proxy_net *proxy) {
+  return rcu_dereference(proxy->live);
+}
+
+// the instance the hooks use, must be called with the proxy lock held
+static inline struct rtp_proxy_instance *proxy_live_locked(struct rtp_proxy_net *proxy) {
+  return rcu_dereference_protected(proxy->live, lockdep_is_held(&proxy->lock));
+}
+
+// the instance commands apply to: the staged one while staging, otherwise the
+// live one, must be called with the proxy lock held
+struct rtp_proxy_instance *proxy_target(struct rtp_proxy_net *proxy);
+
+// start staging an empty instance, replacing one staged before
+bool proxy_stage(struct rtp_proxy_net *proxy);
+
+// make the staged instance live with a single pointer swap, sessions present
+// in both keep their RTP state
+bool proxy_commit(struct rtp_proxy_net *proxy);
+
+// discard the staged instance
+void proxy_abort(struct rtp_proxy_net *proxy);
+
+int register_pernet(void);
+
+void unregister_pernet(void);
+
+#endif // _NETNS_H_
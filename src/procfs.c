@@ -22,98 +22,132 @@
 
 #include "debug.h"
 
+#include <linux/capability.h>
 #include <linux/version.h>
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0)
+#define proc_data(inode) PDE_DATA(inode)
+#else
+#define proc_data(inode) pde_data(inode)
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // proc file read handling: output non-empty table entries
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-static int next_table_index(int index) {
+// sessions are addressed by port and position in the chain of that port
+static int next_table_session(struct table *table, int index, int *n) {
   struct table_entry entry;
-  while(1) {
-    ++index;
-    if(index < TABLE_SIZE) {
-      if(table_get(index, &entry)) {
-        break;
-      }
-      else {
-        continue;
-      }
-    }
-    else {
-      return 0;
+  if(index && table_get_at(table, index, *n + 1, &entry)) {
+    ++*n;
+    return index;
+  }
+  while((index = table_next(table, index))) {
+    if(table_get_at(table, index, 0, &entry)) {
+      break;
     }
   }
+  *n = 0;
   return index;
 }
 
-static void seq_show_table_entry(struct seq_file *seq, uint16_t index, struct table_entry *ent, struct config *cfg)  {
+static void seq_show_table_entry(struct seq_file *seq, struct rtp_proxy_instance *instance, uint16_t index, struct table_entry *ent, struct config *cfg)  {
   if(!index) {
-    uint8_t int_proxy_ip[4] = htoal(ntohl(cfg->int_proxy_addr));
-    uint8_t ext_proxy_ip[4] = htoal(ntohl(cfg->ext_proxy_addr));
+    char int_proxy_ip[ADDR_STR_SIZE];
+    char ext_proxy_ip[ADDR_STR_SIZE];
     uint8_t smoothing = cfg->smoothing;
     uint8_t loopback = cfg->loopback;
-    seq_printf(seq, "config:" " int_proxy_addr: "IP_FMT " ext_proxy_addr: "IP_FMT" smoothing: "U8_FMT" loopback: "U8_FMT"\n",
-               int_proxy_ip[0], int_proxy_ip[1], int_proxy_ip[2], int_proxy_ip[3],
-               ext_proxy_ip[0], ext_proxy_ip[1], ext_proxy_ip[2], ext_proxy_ip[3],
-               smoothing, loopback);
+    uint8_t id;
+    seq_printf(seq, "config:" " int_proxy_addr: %s ext_proxy_addr: %s smoothing: "U8_FMT" loopback: "U8_FMT" single_pass: "U8_FMT" checksum: %s notrack: "U8_FMT" idle_timeout: %u\n",
+               addr_str(int_proxy_ip, cfg->int_proxy_addr),
+               addr_str(ext_proxy_ip, cfg->ext_proxy_addr),
+               smoothing, loopback, cfg->single_pass, checksum_policy_name(cfg->checksum), cfg->notrack, cfg->idle_timeout);
+    for(id = 1; id <= MAX_REALMS; id++) {
+      struct realm realm;
+      if(realm_get(&instance->config, id, &realm)) {
+        seq_printf(seq, "realm: %s int_proxy_addr: %s ext_proxy_addr: %s\n",
+                   realm.name,
+                   addr_str(int_proxy_ip, realm.int_proxy_addr),
+                   addr_str(ext_proxy_ip, realm.ext_proxy_addr));
+      }
+    }
   }
   else {
-    uint8_t int_proxy_ip[4] = htoal(ntohl(cfg->int_proxy_addr));
-    uint8_t ext_proxy_ip[4] = htoal(ntohl(cfg->ext_proxy_addr));
+    char int_proxy_ip[ADDR_STR_SIZE];
+    char ext_proxy_ip[ADDR_STR_SIZE];
     uint16_t proxy_port = ntohs(index);
 
-    uint8_t sender_ip[4] = htoal(ntohl(ent->sender_addr));
+    char sender_ip[ADDR_STR_SIZE];
     uint16_t sender_port = ntohs(ent->sender_port);
 
-    uint8_t receiver_ip[4] = htoal(ntohl(ent->receiver_addr));
+    char receiver_ip[ADDR_STR_SIZE];
     uint16_t receiver_port = ntohs(ent->receiver_port);
 
-    uint8_t sbc_ip[4] = htoal(ntohl(ent->sbc_addr));
+    char sbc_ip[ADDR_STR_SIZE];
     uint16_t sbc_port = ntohs(ent->sbc_port);
 
+    addr_str(int_proxy_ip, addr_is_set(ent->int_proxy_addr) ? ent->int_proxy_addr : cfg->int_proxy_addr);
+    addr_str(ext_proxy_ip, addr_is_set(ent->ext_proxy_addr) ? ent->ext_proxy_addr : cfg->ext_proxy_addr);
+    addr_str(sender_ip, ent->sender_addr);
+    addr_str(receiver_ip, ent->receiver_addr);
+    addr_str(sbc_ip, ent->sbc_addr);
+
     seq_printf(seq,
-               "=> ("IP_PORT_FMT" -> "IP_PORT_FMT") ~> ("IP_PORT_FMT" -> "IP_PORT_FMT")\n",
-               sender_ip[0],    sender_ip[1],   sender_ip[2],    sender_ip[3],     sender_port,
-               int_proxy_ip[0], int_proxy_ip[1], int_proxy_ip[2], int_proxy_ip[3], proxy_port,
-               ext_proxy_ip[0], ext_proxy_ip[1], ext_proxy_ip[2], ext_proxy_ip[3], proxy_port,
-               sbc_ip[0],       sbc_ip[1],       sbc_ip[2],       sbc_ip[3],       sbc_port);
+               "=> (%s:"PORT_FMT" -> %s:"PORT_FMT") ~> (%s:"PORT_FMT" -> %s:"PORT_FMT")\n",
+               sender_ip,    sender_port,
+               int_proxy_ip, proxy_port,
+               ext_proxy_ip, proxy_port,
+               sbc_ip,       sbc_port);
     seq_printf(seq,
-               " < ("IP_PORT_FMT" -> "IP_PORT_FMT") ~> ("IP_PORT_FMT" -> "IP_PORT_FMT")\n",
-               sbc_ip[0],       sbc_ip[1],       sbc_ip[2],       sbc_ip[3],       sbc_port,
-               ext_proxy_ip[0], ext_proxy_ip[1], ext_proxy_ip[2], ext_proxy_ip[3], proxy_port,
-               int_proxy_ip[0], int_proxy_ip[1], int_proxy_ip[2], int_proxy_ip[3], proxy_port,
-               receiver_ip[0],  receiver_ip[1],  receiver_ip[2],  receiver_ip[3],  receiver_port);
+               " < (%s:"PORT_FMT" -> %s:"PORT_FMT") ~> (%s:"PORT_FMT" -> %s:"PORT_FMT")\n",
+               sbc_ip,       sbc_port,
+               ext_proxy_ip, proxy_port,
+               int_proxy_ip, proxy_port,
+               receiver_ip,  receiver_port);
   }
 }
 
+// position 0 is the config, position n the n-th session. Reads continue
+// from the entry the previous chunk stopped at, only seeking walks the table.
+// Each chunk shows the instance that is live when it starts.
 struct iter {
+  struct rtp_proxy_net *proxy;
+  struct rtp_proxy_instance *instance;
   int index;
+  int n;
+  loff_t pos;
 };
 
 static void *rtp_proxy_seq_start(struct seq_file *seq, loff_t *pos) {
-  int position = (int)*pos;
   struct iter *iter = seq->private;
-  if(!position) {
+  rcu_read_lock();
+  iter->instance = proxy_live(iter->proxy);
+  if(!*pos) {
     iter->index = 0;
+    iter->n = 0;
+    iter->pos = 0;
+    return iter;
+  }
+  else if(iter->index && iter->pos == *pos) {
     return iter;
   }
   else {
     int index = 0;
-    while(position >= 0) {
-      --position;
-      index = next_table_index(index);
+    int n = 0;
+    loff_t position = 0;
+    while(position < *pos) {
+      ++position;
+      index = next_table_session(&iter->instance->table, index, &n);
       if(!index) {
-        break;
+        return NULL;
       }
     }
-    if(index) {
-      iter->index = index;
-      return iter;
-    }
-    return NULL;
+    iter->index = index;
+    iter->n = n;
+    iter->pos = position;
+    return iter;
   }
 }
 
@@ -121,16 +155,17 @@ static void *rtp_proxy_seq_next(struct seq_file *seq, void *v, loff_t *pos) {
   struct iter *iter = v;
   int index = iter->index;
   ++*pos;
-  index = next_table_index(index);
+  index = next_table_session(&iter->instance->table, index, &iter->n);
+  iter->index = index;
+  iter->pos = *pos;
   if(index) {
-    iter->index = index;
     return iter;
   }
   return NULL;
 }
 
 static void rtp_proxy_seq_stop(struct seq_file *seq, void *v) {
-  // do nothing
+  rcu_read_unlock();
 }
 
 static int rtp_proxy_seq_show(struct seq_file *seq, void *v) {
@@ -138,9 +173,11 @@ static int rtp_proxy_seq_show(struct seq_file *seq, void *v) {
   int index = iter->index;
   struct table_entry ent;
   struct config cfg;
-  table_get(index, &ent);
-  config_get(&cfg);
-  seq_show_table_entry(seq, index, &ent, &cfg);
+  if(!table_get_at(&iter->instance->table, index, iter->n, &ent) && index) {
+    return SEQ_SKIP; // deleted since the previous chunk
+  }
+  config_get(&iter->instance->config, &cfg);
+  seq_show_table_entry(seq, iter->instance, index, &ent, &cfg);
   return 0;
 }
 
@@ -152,7 +189,12 @@ static struct seq_operations rtp_proxy_seq_ops = {
 };
 
 static int rtp_proxy_open(struct inode *inode, struct file *file) {
-  return seq_open_private(file, &rtp_proxy_seq_ops, sizeof(struct iter));
+  struct iter *iter = __seq_open_private(file, &rtp_proxy_seq_ops, sizeof(struct iter));
+  if(!iter) {
+    return -ENOMEM;
+  }
+  iter->proxy = proc_data(inode);
+  return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -163,8 +205,15 @@ static int rtp_proxy_open(struct inode *inode, struct file *file) {
 
 #define WRITE_BUF_SIZE 256
 static ssize_t rtp_proxy_write(struct file *file, const char *user_buffer, size_t len, loff_t *off) {
+  struct rtp_proxy_net *proxy = proc_data(file_inode(file));
   size_t size = WRITE_BUF_SIZE;
-  char *kernel_buffer = kmalloc(size, GFP_KERNEL);
+  char *kernel_buffer;
+  // namespaces of unprivileged user namespaces have the file as well, only
+  // the network admins of the namespace may configure the proxy
+  if(!ns_capable(proxy->net->user_ns, CAP_NET_ADMIN)) {
+    return -EPERM;
+  }
+  kernel_buffer = kmalloc(size, GFP_KERNEL);
   if(!kernel_buffer) {
     return -ENOMEM;
   }
@@ -182,7 +231,7 @@ static ssize_t rtp_proxy_write(struct file *file, const char *user_buffer, size_
   kernel_buffer[size] = '\0';
 
   if(size > 0) {
-    if(!handle_command(kernel_buffer)) {
+    if(!handle_command(proxy, kernel_buffer)) {
       debug_printk(BANNER "command %s failed\n", kernel_buffer);
     }
   }
@@ -191,6 +240,65 @@ static ssize_t rtp_proxy_write(struct file *file, const char *user_buffer, size_
   return size;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// expired proc file read handling: one "<proxy_port> <int_proxy_ip>" line per
+// expired route, reads block until there is one unless opened non-blocking
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0)
+#define POLL_T unsigned int
+#else
+#define POLL_T __poll_t
+#endif
+
+#define EXPIRED_LINE_SIZE 64
+static ssize_t rtp_proxy_expired_read(struct file *file, char __user *user_buffer, size_t len, loff_t *off) {
+  struct rtp_proxy_net *proxy = proc_data(file_inode(file));
+  struct expired_session session;
+  size_t size = 0;
+
+  if(len < EXPIRED_LINE_SIZE) {
+    return -EINVAL;
+  }
+  // another reader may take the sessions between wake up and pop
+  do {
+    if(!(file->f_flags & O_NONBLOCK)) {
+      int err = wait_event_interruptible(proxy->expire.wait, expire_ready(&proxy->expire));
+      if(err) {
+        return err;
+      }
+    }
+
+    while(size + EXPIRED_LINE_SIZE <= len && expire_pop(&proxy->expire, &session)) {
+      char line[EXPIRED_LINE_SIZE];
+      char int_proxy_ip[ADDR_STR_SIZE];
+      int n = snprintf(line, sizeof(line), PORT_FMT" %s\n",
+                       ntohs(session.index),
+                       addr_str(int_proxy_ip, session.int_proxy_addr));
+      if(copy_to_user(user_buffer + size, line, n)) {
+        return -EFAULT;
+      }
+      size += n;
+    }
+  } while(!size && !(file->f_flags & O_NONBLOCK) && !READ_ONCE(proxy->expire.stopped));
+
+  if(!size && (file->f_flags & O_NONBLOCK)) {
+    return -EAGAIN;
+  }
+  return size;
+}
+
+static POLL_T rtp_proxy_expired_poll(struct file *file, struct poll_table_struct *wait) {
+  struct rtp_proxy_net *proxy = proc_data(file_inode(file));
+  poll_wait(file, &proxy->expire.wait, wait);
+  if(expire_ready(&proxy->expire)) {
+    return (POLL_T)(POLLIN | POLLRDNORM);
+  }
+  return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // proc file creation and removal
@@ -216,11 +324,47 @@ static const struct proc_ops rtp_proxy_file_ops = {
 };
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+static const struct file_operations rtp_proxy_expired_file_ops = {
+  .owner = THIS_MODULE,
+  .read = rtp_proxy_expired_read,
+  .poll = rtp_proxy_expired_poll,
+  .llseek = noop_llseek,
+};
+#else
+static const struct proc_ops rtp_proxy_expired_file_ops = {
+  .proc_read = rtp_proxy_expired_read,
+  .proc_poll = rtp_proxy_expired_poll,
+  .proc_lseek = noop_llseek,
+};
+#endif
+
+#define EXPIRED_FILE_NAME MODULE_NAME "_expired"
 
-void proc_file_create(void) {
-  proc_create(MODULE_NAME, S_IRUGO | S_IWUGO, NULL, &rtp_proxy_file_ops);
+
+int proc_file_create(struct net *net, struct rtp_proxy_net *proxy) {
+  if(!proc_create_data(MODULE_NAME, S_IRUGO | S_IWUSR, net->proc_net, &rtp_proxy_file_ops, proxy)) {
+    return -ENOMEM;
+  }
+  if(!proc_create_data(EXPIRED_FILE_NAME, S_IRUGO, net->proc_net, &rtp_proxy_expired_file_ops, proxy)) {
+    remove_proc_entry(MODULE_NAME, net->proc_net);
+    return -ENOMEM;
+  }
+  // the initial namespace keeps its proc file where it has always been
+  if(net_eq(net, &init_net)) {
+    if(!proc_create_data(MODULE_NAME, S_IRUGO | S_IWUSR, NULL, &rtp_proxy_file_ops, proxy)) {
+      remove_proc_entry(EXPIRED_FILE_NAME, net->proc_net);
+      remove_proc_entry(MODULE_NAME, net->proc_net);
+      return -ENOMEM;
+    }
+  }
+  return 0;
 }
 
-void proc_file_remove(void) {
-  remove_proc_entry(MODULE_NAME, NULL);
+void proc_file_remove(struct net *net) {
+  if(net_eq(net, &init_net)) {
+    remove_proc_entry(MODULE_NAME, NULL);
+  }
+  remove_proc_entry(EXPIRED_FILE_NAME, net->proc_net);
+  remove_proc_entry(MODULE_NAME, net->proc_net);
 }
@@ -19,6 +19,7 @@
 #define _PROCFS_H_
 
 #ifdef __KERNEL__
+#include <linux/poll.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
@@ -27,15 +28,17 @@
 
 #include "module.h"
 
+#include "netns.h"
+
 //API
 
-// create proc file
-void proc_file_create(void);
+// create the proc file of a network namespace
+int proc_file_create(struct net *net, struct rtp_proxy_net *proxy);
 
-// remove proc file
-void proc_file_remove(void);
+// remove the proc file of a network namespace
+void proc_file_remove(struct net *net);
 
 // must be defined elsewhere
-extern bool handle_command(const char *command);
+extern bool handle_command(struct rtp_proxy_net *proxy, const char *command);
 
 #endif // _PROCFS_H_
@@ -37,32 +37,58 @@ struct set_SN_arg {
   uint16_t sn;
 };
 
-static inline void *set_SN_function(struct table_entry *entry, void *arg) {
+static inline void *set_SN_function(struct table_state *state, void *arg) {
   struct set_SN_arg *a = arg;
 
   const uint16_t sn = a->sn;
 
-  if(!entry->entry_used) {
-    entry->entry_used = 1;
+  if(!state->entry_used) {
+    state->entry_used = 1;
   }
   else {
-    uint16_t last_sn = entry->last_sn;
+    uint16_t last_sn = state->last_sn;
     uint16_t expected = last_sn + 1;
     if(sn < expected) {
       uint16_t delta = expected - sn;
       if(delta >= MIN_DELTA) {
-        entry->offset += delta;
+        state->offset += delta;
       }
     }
   }
 
-  entry->last_sn = sn;
-  a->sn += entry->offset;
+  state->last_sn = sn;
+  a->sn += state->offset;
 
   return arg;
 }
 
-static inline void rewrite_rtp(struct udphdr *udp_header, __be16 index, struct table_entry *ent) {
+struct set_SN_batch_arg {
+  struct sk_buff *skb;
+  unsigned int offset; // of the RTP header of the first segment
+  unsigned int size;   // distance of the segments
+};
+
+// the sequence numbers of all segments of a batch in order under a single
+// lock, segments too short for an RTP header are left alone. The UDP checksum
+// of a batch only covers the pseudo header, it needs no update.
+static void *set_SN_batch_function(struct table_state *state, void *arg) {
+  struct set_SN_batch_arg *a = arg;
+  unsigned int offset;
+  for(offset = a->offset; offset + sizeof(struct rtp_packet) <= a->skb->len; offset += a->size) {
+    struct rtp_packet _packet;
+    const struct rtp_packet *packet = skb_header_pointer(a->skb, offset, sizeof(_packet), &_packet);
+    if(packet && packet->V == 2) {
+      struct set_SN_arg sn = { .sn = ntohs(packet->SN), };
+      __be16 SN;
+      set_SN_function(state, &sn);
+      SN = htons(sn.sn);
+      skb_store_bits(a->skb, offset + offsetof(struct rtp_packet, SN), &SN, sizeof(SN));
+    }
+  }
+  return arg;
+}
+
+static inline void rewrite_rtp(struct sk_buff *skb, struct udphdr *udp_header, __be16 index, struct routing *rt) {
   int32_t remaining = ntohs(udp_header->len);
   uint8_t *data = (uint8_t *)udp_header;
   if(remaining >= sizeof(struct udphdr)) {
@@ -72,12 +98,22 @@ static inline void rewrite_rtp(struct udphdr *udp_header, __be16 index, struct t
       return;
     }
     else { // even port -> RTP PACKET
-      if(remaining >= sizeof(struct rtp_packet)) {
+      if(is_udp_batch(skb)) {
+        struct set_SN_batch_arg a = {
+          .skb    = skb,
+          .offset = data - skb->data,
+          .size   = skb_shinfo(skb)->gso_size,
+        };
+        if(a.size) {
+          table_atomically(rt, set_SN_batch_function, &a);
+        }
+      }
+      else if(remaining >= sizeof(struct rtp_packet)) {
         struct rtp_packet *packet = (struct rtp_packet *)data;
         if(packet->V == 2) {
           struct set_SN_arg a = { .sn = ntohs(packet->SN), };
-          table_atomically(index, set_SN_function, &a);
-          packet->SN = htons(a.sn);
+          table_atomically(rt, set_SN_function, &a);
+          checksum_replace_be16(skb, udp_header, &packet->SN, htons(a.sn));
         }
       }
     }
@@ -91,20 +127,26 @@ static inline void rewrite_rtp(struct udphdr *udp_header, __be16 index, struct t
 // if a packet comes from src_addr:src_port to dst_addr:dst_port,
 // then rewrite the packet so that it appears to come from src1_addr:src1_port
 // and goes to dst1_addr:dst1_port. If an address or port is ______________ (0),
-// then it always matches.
+// then it always matches, likewise for an address that is not set. Addresses
+// of packets are compared in their IPv6 form, see addr.h.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-static inline int match_udp_packet(struct iphdr *ip_header, struct udphdr *udp_header,
-                                   __be32 src_addr, __be16 src_port, __be32 dst_addr, __be16 dst_port) {
-  if((!src_addr || S_ADDR == src_addr) &&
+static inline bool is_wildcard(const struct in6_addr *addr) {
+  return !addr || !addr_is_set(*addr);
+}
+
+static inline int match_udp_packet(struct in6_addr saddr, struct in6_addr daddr, struct udphdr *udp_header,
+                                   const struct in6_addr *src_addr, __be16 src_port,
+                                   const struct in6_addr *dst_addr, __be16 dst_port) {
+  if((is_wildcard(src_addr) || addr_eq(saddr, *src_addr)) &&
      (!src_port || S_PORT == src_port) &&
-     (!dst_addr || D_ADDR == dst_addr) &&
+     (is_wildcard(dst_addr) || addr_eq(daddr, *dst_addr)) &&
      (!dst_port || D_PORT == dst_port)) {
     int match = 5;
-    if(!src_addr) match--;
+    if(is_wildcard(src_addr)) match--;
     if(!src_port) match--;
-    if(!dst_addr) match--;
+    if(is_wildcard(dst_addr)) match--;
     if(!dst_port) match--;
     return match;
   }
@@ -117,21 +159,74 @@ static inline int match_udp_packet(struct iphdr *ip_header, struct udphdr *udp_h
 //
 // REWRITE LOGIC
 //
-// Addresses do not get rewritten if the target address is ______________ (0),
-// likewise for ports.
+// Addresses do not get rewritten if the target address is ______________ (0)
+// or not set, likewise for ports. The checksums get updated for each
+// rewritten field. A packet keeps its IP version here, the rewrite fails if a
+// target address is of the other one, see TRANSLATION below for those.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-static inline void rewrite_udp_packet(struct iphdr *ip_header, struct udphdr *udp_header,
-                                      __be32 src_addr, __be16 src_port, __be32 dst_addr, __be16 dst_port) {
-  debug_print_tuple(" BEFORE REWRITE :", S_ADDR, S_PORT, D_ADDR, D_PORT);
-  if(src_addr) S_ADDR = src_addr;
-  if(src_port) S_PORT = src_port;
-  if(dst_addr) D_ADDR = dst_addr;
-  if(dst_port) D_PORT = dst_port;
-  debug_print_tuple(" AFTER REWRITE  :", S_ADDR, S_PORT, D_ADDR, D_PORT);
+// the IPv4 address to rewrite to, 0 to leave the address alone, false if the
+// target is an IPv6 address
+static inline bool target_v4(const struct in6_addr *addr, __be32 *v4) {
+  *v4 = is_wildcard(addr) ? 0 : addr_to_v4(*addr);
+  return is_wildcard(addr) || *v4;
+}
+
+static inline bool rewrite_udp_packet(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header,
+                                      const struct in6_addr *src_addr, __be16 src_port,
+                                      const struct in6_addr *dst_addr, __be16 dst_port) {
+  __be32 saddr, daddr;
+  if(!target_v4(src_addr, &saddr) || !target_v4(dst_addr, &daddr)) {
+    return false;
+  }
+  debug_print_tuple(" BEFORE REWRITE :", addr_v4(S_ADDR), S_PORT, addr_v4(D_ADDR), D_PORT);
+  if(saddr) checksum_replace_addr(skb, ip_header, udp_header, &S_ADDR, saddr);
+  if(src_port) checksum_replace_be16(skb, udp_header, &S_PORT, src_port);
+  if(daddr) checksum_replace_addr(skb, ip_header, udp_header, &D_ADDR, daddr);
+  if(dst_port) checksum_replace_be16(skb, udp_header, &D_PORT, dst_port);
+  debug_print_tuple(" AFTER REWRITE  :", addr_v4(S_ADDR), S_PORT, addr_v4(D_ADDR), D_PORT);
+  return true;
+}
+
+#if IS_ENABLED(CONFIG_IPV6)
+static inline bool target_v6(const struct in6_addr *addr) {
+  return is_wildcard(addr) || !addr_is_v4(*addr);
 }
 
+static inline bool rewrite_udp6_packet(struct sk_buff *skb, struct ipv6hdr *ip6_header, struct udphdr *udp_header,
+                                       const struct in6_addr *src_addr, __be16 src_port,
+                                       const struct in6_addr *dst_addr, __be16 dst_port) {
+  if(!target_v6(src_addr) || !target_v6(dst_addr)) {
+    return false;
+  }
+  debug_print_tuple(" BEFORE REWRITE :", ip6_header->saddr, S_PORT, ip6_header->daddr, D_PORT);
+  if(!is_wildcard(src_addr)) checksum_replace_addr6(skb, udp_header, &ip6_header->saddr, *src_addr);
+  if(src_port) checksum_replace_be16(skb, udp_header, &S_PORT, src_port);
+  if(!is_wildcard(dst_addr)) checksum_replace_addr6(skb, udp_header, &ip6_header->daddr, *dst_addr);
+  if(dst_port) checksum_replace_be16(skb, udp_header, &D_PORT, dst_port);
+  debug_print_tuple(" AFTER REWRITE  :", ip6_header->saddr, S_PORT, ip6_header->daddr, D_PORT);
+  return true;
+}
+#endif
+
+// the routing logic below serves both IP versions, exactly one of ip_header
+// and ip6_header is set, always inlined with the other one a constant NULL
+static __always_inline bool rewrite_packet(struct sk_buff *skb, struct iphdr *ip_header, struct ipv6hdr *ip6_header,
+                                           struct udphdr *udp_header,
+                                           const struct in6_addr *src_addr, __be16 src_port,
+                                           const struct in6_addr *dst_addr, __be16 dst_port) {
+#if IS_ENABLED(CONFIG_IPV6)
+  if(ip6_header) {
+    return rewrite_udp6_packet(skb, ip6_header, udp_header, src_addr, src_port, dst_addr, dst_port);
+  }
+#endif
+  return rewrite_udp_packet(skb, ip_header, udp_header, src_addr, src_port, dst_addr, dst_port);
+}
+
+#define PACKET_SADDR (ip6_header ? ip6_header->saddr : addr_v4(S_ADDR))
+#define PACKET_DADDR (ip6_header ? ip6_header->daddr : addr_v4(D_ADDR))
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // ROUTING LOGIC
@@ -150,34 +245,34 @@ static inline void rewrite_udp_packet(struct iphdr *ip_header, struct udphdr *ud
 ////////////////////////////////////////////////////////////////////////////////
 
 //  shorter names for routing field selection
-#define I_SRC_ADDR rt->i_src_addr
+#define I_SRC_ADDR (&rt->i_src_addr)
 #define I_SRC_PORT rt->i_src_port
-#define I_DST_ADDR rt->i_dst_addr
+#define I_DST_ADDR (&rt->i_dst_addr)
 #define I_DST_PORT rt->i_dst_port
 
-#define I_PRX_ADDR rt->i_prx_addr
+#define I_PRX_ADDR (&rt->i_prx_addr)
 #define I_PRX_PORT rt->i_prx_port
-#define E_PRX_ADDR rt->e_prx_addr
+#define E_PRX_ADDR (&rt->e_prx_addr)
 #define E_PRX_PORT rt->e_prx_port
 
-#define E_SRC_ADDR rt->e_src_addr
+#define E_SRC_ADDR (&rt->e_src_addr)
 #define E_SRC_PORT rt->e_src_port
-#define E_DST_ADDR rt->e_dst_addr
+#define E_DST_ADDR (&rt->e_dst_addr)
 #define E_DST_PORT rt->e_dst_port
 
 #define __________ 0
 
 enum { LOOPBACK_ROUTE, OUTGOING_ROUTE, INCOMING_ROUTE, AMBIGIUOS_ROUTE, NO_ROUTE, };
 
-static inline int match_routes(struct iphdr *ip_header, struct udphdr *udp_header,
+static inline int match_routes(struct in6_addr saddr, struct in6_addr daddr, struct udphdr *udp_header,
                                struct routing *rt) {
-  if(rt->loopback) {
+  if(loopback_enabled() && rt->loopback) {
     debug_printk(BANNER "LOOPBACK_ROUTE\n");
     return LOOPBACK_ROUTE;
   }
   else {
-    int outgoing_route_match = match_udp_packet(ip_header, udp_header, I_SRC_ADDR, I_SRC_PORT, __________, I_PRX_PORT);
-    int incoming_route_match = match_udp_packet(ip_header, udp_header, E_SRC_ADDR, E_SRC_PORT, __________, E_PRX_PORT);
+    int outgoing_route_match = match_udp_packet(saddr, daddr, udp_header, I_SRC_ADDR, I_SRC_PORT, __________, I_PRX_PORT);
+    int incoming_route_match = match_udp_packet(saddr, daddr, udp_header, E_SRC_ADDR, E_SRC_PORT, __________, E_PRX_PORT);
     if(outgoing_route_match > 0 || incoming_route_match > 0) {
       if(outgoing_route_match > incoming_route_match) {
         debug_printk(BANNER "OUTGOING_ROUTE\n");
@@ -199,72 +294,199 @@ static inline int match_routes(struct iphdr *ip_header, struct udphdr *udp_heade
   }
 }
 
-static inline unsigned int handle_incoming_udp_packet(struct iphdr *ip_header, struct udphdr *udp_header,
-                                                      struct routing *rt) {
-  switch(match_routes(ip_header, udp_header, rt)) {
+static __always_inline unsigned int handle_incoming_udp_packet(struct sk_buff *skb, struct iphdr *ip_header, struct ipv6hdr *ip6_header,
+                                                               struct udphdr *udp_header, struct routing *rt) {
+  bool rewritten;
+  switch(match_routes(PACKET_SADDR, PACKET_DADDR, udp_header, rt)) {
   case LOOPBACK_ROUTE:
   case OUTGOING_ROUTE:
-    rewrite_udp_packet(ip_header, udp_header, __________, __________, E_DST_ADDR, __________);
-    return NF_ACCEPT;
+    rewritten = rewrite_packet(skb, ip_header, ip6_header, udp_header, __________, __________, E_DST_ADDR, __________);
+    return rewritten ? NF_ACCEPT : NF_DROP;
   case INCOMING_ROUTE:
-    rewrite_udp_packet(ip_header, udp_header, __________, __________, I_DST_ADDR, __________);
-    return NF_ACCEPT;
+    rewritten = rewrite_packet(skb, ip_header, ip6_header, udp_header, __________, __________, I_DST_ADDR, __________);
+    return rewritten ? NF_ACCEPT : NF_DROP;
   case AMBIGIUOS_ROUTE:
   default:
     return NF_DROP;
   }
 }
 
-static unsigned int handle_outgoing_udp_packet(struct iphdr *ip_header, struct udphdr *udp_header,
-                                               struct table_entry *ent, struct routing *rt) {
-  switch(match_routes(ip_header, udp_header, rt)) {
+static __always_inline unsigned int handle_outgoing_udp_packet(struct sk_buff *skb, struct iphdr *ip_header, struct ipv6hdr *ip6_header,
+                                                               struct udphdr *udp_header, struct table_entry *ent, struct routing *rt) {
+  switch(match_routes(PACKET_SADDR, PACKET_DADDR, udp_header, rt)) {
   case LOOPBACK_ROUTE:
   case OUTGOING_ROUTE:
-    rewrite_udp_packet(ip_header, udp_header, E_PRX_ADDR, E_PRX_PORT, __________, E_DST_PORT);
-    if(rt->smoothing){
-      rewrite_rtp(udp_header, E_PRX_PORT, ent);
+    if(!rewrite_packet(skb, ip_header, ip6_header, udp_header, E_PRX_ADDR, E_PRX_PORT, __________, E_DST_PORT)) {
+      return NF_DROP;
+    }
+    if(smoothing_enabled() && rt->smoothing) {
+      rewrite_rtp(skb, udp_header, E_PRX_PORT, rt);
     }
     return NF_ACCEPT;
   case INCOMING_ROUTE:
-    rewrite_udp_packet(ip_header, udp_header, I_PRX_ADDR, I_PRX_PORT, __________, I_DST_PORT);
-      return NF_ACCEPT;
+    if(!rewrite_packet(skb, ip_header, ip6_header, udp_header, I_PRX_ADDR, I_PRX_PORT, __________, I_DST_PORT)) {
+      return NF_DROP;
+    }
+    return NF_ACCEPT;
   default:
     return NF_DROP;
   }
 }
 
-static unsigned int pre_route_udp_packet(struct iphdr *ip_header, struct udphdr *udp_header,
-                                         struct table_entry *_ent, struct routing *rt) {
-  return handle_incoming_udp_packet(ip_header, udp_header, rt);
+// required by mangle.c
+unsigned int pre_route_udp_packet(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header,
+                                  struct table_entry *_ent, struct routing *rt) {
+  return handle_incoming_udp_packet(skb, ip_header, NULL, udp_header, rt);
 }
 
-static unsigned int local_in_udp_packet(struct iphdr *ip_header, struct udphdr *udp_header,
-                                        struct table_entry *ent, struct routing *rt) {
-  return handle_outgoing_udp_packet(ip_header, udp_header, ent, rt);
+// required by mangle.c
+unsigned int local_in_udp_packet(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header,
+                                 struct table_entry *ent, struct routing *rt) {
+  return handle_outgoing_udp_packet(skb, ip_header, NULL, udp_header, ent, rt);
 }
 
-//static unsigned int forward_udp_packet(struct iphdr *ip_header, struct udphdr *udp_header,
+//static unsigned int forward_udp_packet(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header,
 //                                       struct table_entry *ent, struct routing *rt) {
 //  return NF_ACCEPT;
 //}
 
-static unsigned int local_out_udp_packet(struct iphdr *ip_header, struct udphdr *udp_header,
-                                         struct table_entry *_ent, struct routing *rt) {
-  return handle_incoming_udp_packet(ip_header, udp_header, rt);
+// required by mangle.c
+unsigned int local_out_udp_packet(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header,
+                                  struct table_entry *_ent, struct routing *rt) {
+  return handle_incoming_udp_packet(skb, ip_header, NULL, udp_header, rt);
+}
+
+// required by mangle.c
+unsigned int post_route_udp_packet(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header,
+                                   struct table_entry *ent, struct routing *rt) {
+  return handle_outgoing_udp_packet(skb, ip_header, NULL, udp_header, ent, rt);
+}
+
+#if IS_ENABLED(CONFIG_IPV6)
+// required by mangle.c
+unsigned int pre_route_udp6_packet(struct sk_buff *skb, struct ipv6hdr *ip6_header, struct udphdr *udp_header,
+                                   struct table_entry *_ent, struct routing *rt) {
+  return handle_incoming_udp_packet(skb, NULL, ip6_header, udp_header, rt);
+}
+
+// required by mangle.c
+unsigned int local_in_udp6_packet(struct sk_buff *skb, struct ipv6hdr *ip6_header, struct udphdr *udp_header,
+                                  struct table_entry *ent, struct routing *rt) {
+  return handle_outgoing_udp_packet(skb, NULL, ip6_header, udp_header, ent, rt);
 }
 
-static unsigned int post_route_udp_packet(struct iphdr *ip_header, struct udphdr *udp_header,
-                                          struct table_entry *ent, struct routing *rt) {
-  return handle_outgoing_udp_packet(ip_header, udp_header, ent, rt);
+// required by mangle.c
+unsigned int local_out_udp6_packet(struct sk_buff *skb, struct ipv6hdr *ip6_header, struct udphdr *udp_header,
+                                   struct table_entry *_ent, struct routing *rt) {
+  return handle_incoming_udp_packet(skb, NULL, ip6_header, udp_header, rt);
+}
+
+// required by mangle.c
+unsigned int post_route_udp6_packet(struct sk_buff *skb, struct ipv6hdr *ip6_header, struct udphdr *udp_header,
+                                    struct table_entry *ent, struct routing *rt) {
+  return handle_outgoing_udp_packet(skb, NULL, ip6_header, udp_header, ent, rt);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SINGLE PASS
+//
+// Relayed packets get rewritten completely in PRE_ROUTING and sent out from
+// there. Loopback routes end on this host, so they take the normal path, as
+// do IPv6 routes.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// required by mangle.c
+bool get_relay_target(struct iphdr *ip_header, struct udphdr *udp_header,
+                      struct routing *rt, struct relay_target *sp) {
+  switch(match_routes(addr_v4(S_ADDR), addr_v4(D_ADDR), udp_header, rt)) {
+  case OUTGOING_ROUTE:
+    sp->direction = ROUTE_EXTERNAL;
+    sp->sport = E_PRX_PORT;
+    sp->dport = E_DST_PORT;
+    return target_v4(E_PRX_ADDR, &sp->saddr) && target_v4(E_DST_ADDR, &sp->daddr);
+  case INCOMING_ROUTE:
+    sp->direction = ROUTE_INTERNAL;
+    sp->sport = I_PRX_PORT;
+    sp->dport = I_DST_PORT;
+    return target_v4(I_PRX_ADDR, &sp->saddr) && target_v4(I_DST_ADDR, &sp->daddr);
+  default:
+    return false;
+  }
+}
+
+// required by mangle.c
+void single_pass_udp_packet(struct sk_buff *skb, struct iphdr *ip_header, struct udphdr *udp_header,
+                            struct routing *rt, struct relay_target *sp) {
+  const struct in6_addr saddr = addr_v4(sp->saddr);
+  const struct in6_addr daddr = addr_v4(sp->daddr);
+  rewrite_udp_packet(skb, ip_header, udp_header, &saddr, sp->sport, &daddr, sp->dport);
+  if(sp->direction == ROUTE_EXTERNAL && smoothing_enabled() && rt->smoothing) {
+    rewrite_rtp(skb, udp_header, E_PRX_PORT, rt);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// TRANSLATION
+//
+// Packets of interworking sessions that change their IP version get relayed
+// in PRE_ROUTING (see translate.h). Here the ports and RTP get rewritten like
+// in the two passes, the new IP header takes the addresses of the target.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// required by mangle.c
+bool get_translate_target(struct in6_addr saddr, struct in6_addr daddr, struct udphdr *udp_header,
+                          struct routing *rt, struct translate_target *target) {
+  switch(match_routes(saddr, daddr, udp_header, rt)) {
+  case OUTGOING_ROUTE:
+    target->direction = ROUTE_EXTERNAL;
+    target->saddr = *E_PRX_ADDR;
+    target->sport = E_PRX_PORT;
+    target->daddr = *E_DST_ADDR;
+    target->dport = E_DST_PORT;
+    break;
+  case INCOMING_ROUTE:
+    target->direction = ROUTE_INTERNAL;
+    target->saddr = *I_PRX_ADDR;
+    target->sport = I_PRX_PORT;
+    target->daddr = *I_DST_ADDR;
+    target->dport = I_DST_PORT;
+    break;
+  default:
+    return false;
+  }
+  return addr_is_set(target->saddr) && addr_is_set(target->daddr) &&
+    addr_is_v4(target->saddr) == addr_is_v4(target->daddr) &&
+    addr_is_v4(target->daddr) != addr_is_v4(saddr);
+}
+
+// required by mangle.c
+void translate_udp_packet(struct sk_buff *skb, struct udphdr *udp_header,
+                          struct routing *rt, struct translate_target *target) {
+  if(target->sport) checksum_replace_be16(skb, udp_header, &S_PORT, target->sport);
+  if(target->dport) checksum_replace_be16(skb, udp_header, &D_PORT, target->dport);
+  if(target->direction == ROUTE_EXTERNAL && smoothing_enabled() && rt->smoothing) {
+    rewrite_rtp(skb, udp_header, E_PRX_PORT, rt);
+  }
 }
 
 static struct mangle_hook mangle_hook[] =
   {
-   { .hooknum = NF_IP_PRE_ROUTING,  .name = "PRE_ROUTING ", .fn = pre_route_udp_packet,  .priority = NF_IP_PRI_FIRST, },
-   { .hooknum = NF_IP_LOCAL_IN,     .name = "LOCAL_IN    ", .fn = local_in_udp_packet,   .priority = NF_IP_PRI_LAST,  },
-   //{ .hooknum = NF_IP_FORWARD,      .name = "FORWARD     ", .fn = forward_udp_packet,    .priority = NF_IP_PRI_FILTER, },
-   { .hooknum = NF_IP_LOCAL_OUT,    .name = "LOCAL_OUT   ", .fn = local_out_udp_packet,  .priority = NF_IP_PRI_FIRST, },
-   { .hooknum = NF_IP_POST_ROUTING, .name = "POST_ROUTING", .fn = post_route_udp_packet, .priority = NF_IP_PRI_LAST,  },
+   { .pf = PF_INET,  .hooknum = NF_IP_PRE_ROUTING,    .name = "PRE_ROUTING ",  .priority = NF_IP_PRI_FIRST,  },
+   { .pf = PF_INET,  .hooknum = NF_IP_LOCAL_IN,       .name = "LOCAL_IN    ",  .priority = NF_IP_PRI_LAST,   },
+   //{ .pf = PF_INET,  .hooknum = NF_IP_FORWARD,        .name = "FORWARD     ",  .priority = NF_IP_PRI_FILTER, },
+   { .pf = PF_INET,  .hooknum = NF_IP_LOCAL_OUT,      .name = "LOCAL_OUT   ",  .priority = NF_IP_PRI_FIRST,  },
+   { .pf = PF_INET,  .hooknum = NF_IP_POST_ROUTING,   .name = "POST_ROUTING",  .priority = NF_IP_PRI_LAST,   },
+#if IS_ENABLED(CONFIG_IPV6)
+   { .pf = PF_INET6, .hooknum = NF_INET_PRE_ROUTING,  .name = "PRE_ROUTING6",  .priority = NF_IP6_PRI_FIRST, },
+   { .pf = PF_INET6, .hooknum = NF_INET_LOCAL_IN,     .name = "LOCAL_IN6   ",  .priority = NF_IP6_PRI_LAST,  },
+   { .pf = PF_INET6, .hooknum = NF_INET_LOCAL_OUT,    .name = "LOCAL_OUT6  ",  .priority = NF_IP6_PRI_FIRST, },
+   { .pf = PF_INET6, .hooknum = NF_INET_POST_ROUTING, .name = "POST_ROUTING6", .priority = NF_IP6_PRI_LAST,  },
+#endif
   };
 
 #define HOOK_COUNT (sizeof(mangle_hook) / sizeof(mangle_hook[0]))
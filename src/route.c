@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "route.h"
+
+#include "debug.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// route cache: a cached route is used as long as it was looked up for the
+// same addresses and the FIB did not change since (see dst_check), otherwise
+// it gets replaced. Concurrent misses both look up the route, the last one
+// stays cached.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+DEFINE_PER_CPU(bool, route_transmit_active);
+
+static void route_free_rcu(struct rcu_head *head) {
+  struct route *route = container_of(head, struct route, rcu);
+  dst_release(route->dst);
+  kfree(route);
+}
+
+static struct route *route_lookup(struct net *net, __be32 saddr, __be32 daddr) {
+  struct route *route;
+  struct flowi4 fl4;
+  struct rtable *rt;
+  memset(&fl4, 0, sizeof(fl4));
+  fl4.daddr = daddr;
+  fl4.saddr = saddr;
+  fl4.flowi4_proto = IPPROTO_UDP;
+  rt = ip_route_output_key(net, &fl4);
+  if(IS_ERR(rt)) {
+    debug_printk(BANNER "route_lookup: no route\n");
+    return NULL;
+  }
+  route = kmalloc(sizeof(*route), GFP_ATOMIC);
+  if(!route) {
+    ip_rt_put(rt);
+    return NULL;
+  }
+  route->dst = &rt->dst;
+  route->saddr = saddr;
+  route->daddr = daddr;
+  return route;
+}
+
+static inline bool is_route_current(struct route *route, __be32 saddr, __be32 daddr) {
+  return route->saddr == saddr && route->daddr == daddr && dst_check(route->dst, 0);
+}
+
+struct dst_entry *route_output(struct route_cache *cache, int direction, struct net *net, __be32 saddr, __be32 daddr) {
+  struct route *route = rcu_dereference(cache->route[direction]);
+  if(!route || !is_route_current(route, saddr, daddr)) {
+    struct route *old;
+    route = route_lookup(net, saddr, daddr);
+    if(!route) {
+      return NULL;
+    }
+    old = (struct route __force *)xchg(&cache->route[direction], (struct route __force __rcu *)route);
+    if(old) {
+      call_rcu(&old->rcu, route_free_rcu);
+    }
+  }
+  return route->dst;
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROUTE_H_
+#define _ROUTE_H_
+
+#ifdef __KERNEL__
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#include <net/dst.h>
+#include <net/route.h>
+#endif
+
+#include "module.h"
+
+// packets of a session either go to the external side (the SBC) or to the
+// internal side (the receiver)
+enum { ROUTE_EXTERNAL, ROUTE_INTERNAL, ROUTE_DIRECTIONS, };
+
+// an output route and the addresses it was looked up for, immutable once
+// published
+struct route {
+  struct dst_entry *dst; // holds a reference
+  __be32 saddr;
+  __be32 daddr;
+  struct rcu_head rcu;
+};
+
+// output routes of a session, one per direction
+struct route_cache {
+  struct route __rcu *route[ROUTE_DIRECTIONS];
+};
+
+// free the cached routes, no reader may see the cache any more
+static inline void route_cache_clear(struct route_cache *cache) {
+  int direction;
+  for(direction = 0; direction < ROUTE_DIRECTIONS; direction++) {
+    struct route *route = rcu_dereference_protected(cache->route[direction], 1);
+    if(route) {
+      dst_release(route->dst);
+      kfree(route);
+    }
+    RCU_INIT_POINTER(cache->route[direction], NULL);
+  }
+}
+
+#ifdef __KERNEL__
+// output route from saddr to daddr, taken from the cache as long as it is
+// current. Must be called in an RCU read side critical section, the route is
+// not referenced for the caller. Returns NULL if there is no route.
+struct dst_entry *route_output(struct route_cache *cache, int direction, struct net *net, __be32 saddr, __be32 daddr);
+
+// set while route_transmit() hands a packet to the output path, whose
+// POST_ROUTING hooks run on the same CPU before it returns (like
+// nf_skb_duplicated of xt_TEE)
+DECLARE_PER_CPU(bool, route_transmit_active);
+
+// whether the hook sees a packet sent by route_transmit(), which is completely
+// rewritten already and must not be mangled again
+static inline bool route_transmitting(void) {
+  return __this_cpu_read(route_transmit_active);
+}
+
+// send a received packet out on the route set as its dst, must be called
+// with bottom halves disabled, as the hooks and the ingress hook are
+static inline void route_transmit(struct net *net, struct sk_buff *skb) {
+  // fq would take the receive time stamp for a departure time
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+  skb_clear_tstamp(skb);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+  skb->tstamp = 0;
+#endif
+  __this_cpu_write(route_transmit_active, true);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0)
+  dst_output(skb);
+#else
+  dst_output(net, skb->sk, skb);
+#endif
+  __this_cpu_write(route_transmit_active, false);
+}
+#endif
+
+#endif // _ROUTE_H_
@@ -17,87 +17,233 @@
 
 #include "table.h"
 
-struct table_row {
-  spinlock_t lock;
+// Route lookups on the packet path are RCU reads without any lock: each row
+// publishes a pointer to an immutable copy of its entry. Writers serialize on
+// the table lock, publish a fresh copy and free the old one after a grace
+// period. The per-packet RTP state lives in a separate, cache line aligned
+// struct table_state that is handed over from copy to copy and modified in
+// place under its own lock (see table_atomically), so packets only ever read
+// the routing data.
+//
+// Every published record carries its routing precompiled from the entry and
+// the config, with loopback cascades already resolved. It stays valid as long
+// as the config generation and the version of the cascaded peer row are the
+// ones it was compiled against, otherwise the routing is computed on the fly
+// until the record gets recompiled.
+//
+// The rows are stored in a two level page table indexed by port: a page of
+// TABLE_PAGE_SIZE rows only exists while at least one of its rows is in use,
+// so memory and iteration cost scale with the number of active sessions. A
+// bitmap of the rows in use allows iterating with find_next_bit().
+//
+// A session is identified by its port and its internal proxy address, so
+// that a host with several proxy addresses can use every port once per
+// address. Each row holds the sessions of its port in a short list sorted by
+// internal proxy address, its length is bounded by the number of addresses.
+// Sessions in a realm carry copies of the proxy addresses of their realm,
+// they are moved when the realm changes.
+
+// A table holding sessions enables sessions_key, without any session in any
+// table the hooks return right away. The key may sleep, so it follows the
+// session count after the table lock is dropped; writers of a table are
+// serialized by the caller.
+
+#define page_of(index) ((index) >> TABLE_PAGE_BITS)
+#define row_of(index)  ((index) & (TABLE_PAGE_SIZE - 1))
+
+struct table_record {
+  struct table_record __rcu *next; // next session of the same port
   struct table_entry entry;
+  struct routing routing;
+  uint32_t generation;   // config generation the routing was compiled for
+  uint32_t peer_version; // version of the peer row it was compiled against
+  __be16 peer;           // index of the cascaded peer, or 0
+  struct table_state *state;
+  bool state_moved;      // state taken over by another table, see table_adopt()
+  struct rcu_head rcu;
+};
+
+struct table_row {
+  uint32_t version; // changes whenever a session of the row changes
+  struct table_record __rcu *record;
 };
 
-static struct table_row table[TABLE_SIZE];
+struct table_page {
+  struct table_row rows[TABLE_PAGE_SIZE];
+  int count; // number of sessions in the page
+  struct table_page *next_free; // next page detached by table_clr()
+  struct rcu_head rcu;
+};
+
+DEFINE_STATIC_KEY_FALSE(sessions_key);
+
+// enable the hooks when the table got its first session, disable them when
+// it lost its last one
+static void table_sync_key(struct table *table) {
+  bool populated = READ_ONCE(table->sessions) > 0;
+  if(populated && !table->populated) {
+    static_branch_inc(&sessions_key);
+  }
+  else if(!populated && table->populated) {
+    static_branch_dec(&sessions_key);
+  }
+  table->populated = populated;
+}
 
 static inline bool is_entry_valid( struct table_entry *entry) {
   return
-    entry->receiver_addr && entry->receiver_port &&
-    entry->sbc_addr && entry->sbc_port;
+    addr_is_set(entry->receiver_addr) && entry->receiver_port &&
+    addr_is_set(entry->sbc_addr) && entry->sbc_port;
 }
 
-void table_init(void) {
-  int index;
-  for(index = 0; index < TABLE_SIZE; index++) {
-    spin_lock_init(&table[index].lock);
+static inline struct in6_addr int_proxy_addr(struct config *cfg, struct table_entry *entry) {
+  if(addr_is_set(entry->int_proxy_addr)) {
+    return entry->int_proxy_addr;
   }
-  table_clr();
+  return cfg->int_proxy_addr;
 }
 
-bool table_get(__be16 index, struct table_entry *entry) {
-  spin_lock_bh(&table[index].lock);
-  *entry = table[index].entry;
-  spin_unlock_bh(&table[index].lock);
-  return is_entry_valid(entry);
+static inline struct in6_addr ext_proxy_addr(struct config *cfg, struct table_entry *entry) {
+  if(addr_is_set(entry->ext_proxy_addr)) {
+    return entry->ext_proxy_addr;
+  }
+  return cfg->ext_proxy_addr;
 }
 
-void table_put(__be16 index, struct table_entry *entry) {
-  spin_lock_bh(&table[index].lock);
-  table[index].entry = *entry;
-  spin_unlock_bh(&table[index].lock);
+// must be called in an RCU read side critical section
+static inline struct table_row *row_get(struct table *table, __be16 index) {
+  struct table_page *page = rcu_dereference(table->pages[page_of(index)]);
+  if(page) {
+    return &page->rows[row_of(index)];
+  }
+  return NULL;
 }
 
-void table_del(__be16 index) {
-  empty_struct(table_entry, empty);
-  table_put(index, &empty);
+// must be called in an RCU read side critical section
+static inline struct table_record *record_get(struct table *table, __be16 index) {
+  struct table_row *row = row_get(table, index);
+  if(row) {
+    return rcu_dereference(row->record);
+  }
+  return NULL;
 }
 
-void table_clr(void) {
-  int index;
-  for(index = 0; index < TABLE_SIZE; index++) {
-    table_del(index);
-  }
+// whether a packet from src_addr:src_port may come from addr:port, unset
+// addresses and ports match anything
+static inline bool is_source(struct in6_addr addr, __be16 port, struct in6_addr src_addr, __be16 src_port) {
+  return
+    (!addr_is_set(addr) || !addr_is_set(src_addr) || addr_eq(addr, src_addr)) &&
+    (!port || !src_port || port == src_port);
 }
 
-void *table_atomically(__be16 index, table_function *fn, void *arg) {
-  if(fn) {
-    void *result = NULL;
-    spin_lock_bh(&table[index].lock);
-    result = fn(&table[index].entry, arg);
-    spin_unlock_bh(&table[index].lock);
-    return result;
+// Find the session of a port a packet from src_addr:src_port to addr belongs
+// to, must be called in an RCU read side critical section. A port with a
+// single session matches any address, as before sessions had addresses.
+// Otherwise addr is matched against the proxy addresses, and in the hooks
+// after routing, when the destination has already been rewritten, against
+// the destinations of the sessions. Sessions sharing a destination, like one
+// SBC, are told apart by the source the packet must have come from to be
+// sent there, only sessions alike in that as well take the first one.
+static struct table_record *record_find(struct table *table, __be16 index, struct in6_addr addr,
+                                        struct in6_addr src_addr, __be16 src_port, struct config *cfg) {
+  struct table_record *head = record_get(table, index);
+  struct table_record *record;
+  if(!head || !rcu_access_pointer(head->next)) {
+    return head;
   }
-  else {
+  for(record = head; record; record = rcu_dereference(record->next)) {
+    if(addr_eq(addr, int_proxy_addr(cfg, &record->entry)) || addr_eq(addr, ext_proxy_addr(cfg, &record->entry))) {
+      return record;
+    }
+  }
+  for(record = head; record; record = rcu_dereference(record->next)) {
+    struct routing *rt = &record->routing;
+    if((addr_eq(addr, rt->e_dst_addr) && is_source(rt->i_src_addr, rt->i_src_port, src_addr, src_port)) ||
+       (addr_eq(addr, rt->i_dst_addr) && is_source(rt->e_src_addr, rt->e_src_port, src_addr, src_port))) {
+      return record;
+    }
+  }
+  for(record = head; record; record = rcu_dereference(record->next)) {
+    if(addr_eq(addr, record->routing.i_dst_addr) || addr_eq(addr, record->routing.e_dst_addr)) {
+      return record;
+    }
+  }
+  return NULL;
+}
+
+#define deref_locked(p) \
+  rcu_dereference_protected(p, lockdep_is_held(&table->lock))
+
+#define page_locked(index) \
+  deref_locked(table->pages[page_of(index)])
+
+// must be called with the table lock held, returns the link pointing to the
+// session of index and addr, or to where it has to be inserted
+static struct table_record __rcu **link_locked(struct table *table, __be16 index, struct in6_addr addr) {
+  struct table_page *page = page_locked(index);
+  struct table_record __rcu **link;
+  struct table_record *record;
+  if(!page) {
     return NULL;
   }
+  link = &page->rows[row_of(index)].record;
+  while((record = deref_locked(*link)) && addr_lt(record->entry.int_proxy_addr, addr)) {
+    link = &record->next;
+  }
+  return link;
+}
+
+// must be called with the table lock held
+static inline struct table_record *record_locked(struct table *table, __be16 index, struct in6_addr addr) {
+  struct table_record __rcu **link = link_locked(table, index, addr);
+  if(link) {
+    struct table_record *record = deref_locked(*link);
+    if(record && addr_eq(record->entry.int_proxy_addr, addr)) {
+      return record;
+    }
+  }
+  return NULL;
+}
+
+// must be called in an RCU read side critical section
+static inline uint32_t row_version(struct table *table, __be16 index) {
+  struct table_row *row = row_get(table, index);
+  if(row) {
+    uint32_t version = READ_ONCE(row->version);
+    smp_rmb(); // pairs with smp_wmb() in row_publish(table)
+    return version;
+  }
+  return 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// routing compilation
+//
+////////////////////////////////////////////////////////////////////////////////
+
 static inline void init_routing(__be16 index,
                                 struct config *cfg,
                                 struct table_entry *entry,
                                 struct routing *routing) {
-  __be32 i_src_addr = entry->sender_addr;
-  __be16 i_src_port = entry->sender_port;
-  __be32 i_dst_addr = entry->receiver_addr;
-  __be16 i_dst_port = entry->receiver_port;
+  struct in6_addr i_src_addr = entry->sender_addr;
+  __be16          i_src_port = entry->sender_port;
+  struct in6_addr i_dst_addr = entry->receiver_addr;
+  __be16          i_dst_port = entry->receiver_port;
 
-  __be32 i_prx_addr = cfg->int_proxy_addr;
-  __be16 i_prx_port = index;
-  __be32 e_prx_addr = cfg->ext_proxy_addr;
-  __be16 e_prx_port = index;
+  struct in6_addr i_prx_addr = int_proxy_addr(cfg, entry);
+  __be16          i_prx_port = index;
+  struct in6_addr e_prx_addr = ext_proxy_addr(cfg, entry);
+  __be16          e_prx_port = index;
 
-  __be32 e_src_addr = entry->sbc_addr;
-  __be16 e_src_port = entry->sbc_port;
-  __be32 e_dst_addr = entry->sbc_addr;
-  __be16 e_dst_port = entry->sbc_port;
+  struct in6_addr e_src_addr = entry->sbc_addr;
+  __be16          e_src_port = entry->sbc_port;
+  struct in6_addr e_dst_addr = entry->sbc_addr;
+  __be16          e_dst_port = entry->sbc_port;
 
   uint8_t smoothing = cfg->smoothing;
 
-  if(cfg->loopback && i_dst_addr == i_prx_addr && i_dst_port == i_prx_port) {
+  if(cfg->loopback && addr_eq(i_dst_addr, i_prx_addr) && i_dst_port == i_prx_port) {
     routing->i_src_addr = e_src_addr;
     routing->i_src_port = e_src_port;
     routing->i_dst_addr = e_dst_addr;
@@ -137,46 +283,611 @@ static inline void init_routing(__be16 index,
   routing->smoothing = smoothing;
 }
 
-bool get_routing(__be16 index,
+static inline __be16 cascade_peer(struct config *cfg, struct table_entry *entry) {
+  if(cfg->loopback && addr_eq(entry->sbc_addr, ext_proxy_addr(cfg, entry))) {
+    return entry->sbc_port;
+  }
+  return 0;
+}
+
+// must be called in an RCU read side critical section
+static void compile_routing(struct table *table,
+                            __be16 index,
+                            struct config *cfg,
+                            struct table_record *record,
+                            struct routing *routing) {
+  struct table_entry *entry = &record->entry;
+  __be16 peer = cascade_peer(cfg, entry);
+  init_routing(index, cfg, entry, routing);
+  routing->state = record->state;
+  routing->own_state = record->state;
+  if(peer) {
+    struct table_record *rec = record_find(table, peer, entry->sbc_addr, ADDR_NONE, 0, cfg);
+    if(rec && is_entry_valid(&rec->entry)) {
+      struct routing tmp;
+      init_routing(peer, cfg, &rec->entry, &tmp);
+
+      routing->e_prx_addr = tmp.i_prx_addr;
+      routing->e_prx_port = tmp.i_prx_port;
+      routing->e_src_addr = tmp.i_src_addr;
+      routing->e_src_port = tmp.i_src_port;
+      routing->e_dst_addr = tmp.i_dst_addr;
+      routing->e_dst_port = tmp.i_dst_port;
+
+      routing->state = rec->state;
+    }
+  }
+  routing->interworking =
+    addr_is_set(routing->i_dst_addr) && addr_is_set(routing->e_dst_addr) &&
+    addr_is_v4(routing->i_dst_addr) != addr_is_v4(routing->e_dst_addr);
+}
+
+static void precompile_routing(struct table *table, __be16 index, struct table_record *record) {
+  struct config cfg;
+  config_get(table->config, &cfg);
+  rcu_read_lock();
+  record->generation = cfg.generation;
+  record->peer = cascade_peer(&cfg, &record->entry);
+  record->peer_version = record->peer ? row_version(table, record->peer) : 0;
+  compile_routing(table, index, &cfg, record, &record->routing);
+  rcu_read_unlock();
+}
+
+// must be called in an RCU read side critical section
+static inline bool is_routing_current(struct table *table, struct table_record *record, struct config *cfg) {
+  return
+    record->generation == cfg->generation &&
+    (!record->peer || row_version(table, record->peer) == record->peer_version);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// table modification, all with the table lock held
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static struct table_state *state_new(void) {
+  struct table_state *state = kzalloc(sizeof(*state), GFP_ATOMIC);
+  if(state) {
+    spin_lock_init(&state->lock);
+    get_random_bytes(&state->offset, sizeof(state->offset));
+    state->last_seen = jiffies;
+  }
+  return state;
+}
+
+static void state_free_rcu(struct rcu_head *head) {
+  struct table_state *state = container_of(head, struct table_state, rcu);
+  route_cache_clear(&state->routes);
+  kfree(state);
+}
+
+// readers may still cache routes in the state until the grace period ends
+static inline void state_free(struct table_state *state) {
+  call_rcu(&state->rcu, state_free_rcu);
+}
+
+static inline void record_free(struct table_record *record) {
+  state_free(record->state);
+  kfree_rcu(record, rcu);
+}
+
+// make sure the page of index exists
+static bool page_ensure(struct table *table, __be16 index) {
+  if(!page_locked(index)) {
+    struct table_page *page = kzalloc(sizeof(*page), GFP_ATOMIC);
+    if(!page) {
+      return false;
+    }
+    rcu_assign_pointer(table->pages[page_of(index)], page);
+  }
+  return true;
+}
+
+// free the page of index if it holds no sessions
+static void page_trim(struct table *table, __be16 index) {
+  struct table_page *page = page_locked(index);
+  if(page && !page->count) {
+    RCU_INIT_POINTER(table->pages[page_of(index)], NULL);
+    kfree_rcu(page, rcu);
+  }
+}
+
+// replace, insert or (if record is NULL) remove the session of index and addr,
+// returns the old record, the page of index must exist if record is non-NULL
+static struct table_record *row_publish(struct table *table, __be16 index, struct in6_addr addr, struct table_record *record, bool changed) {
+  struct table_page *page = page_locked(index);
+  struct table_row *row;
+  struct table_record __rcu **link;
+  struct table_record *old;
+  if(!page) {
+    return NULL;
+  }
+  row = &page->rows[row_of(index)];
+  link = link_locked(table, index, addr);
+  old = deref_locked(*link);
+  if(old && !addr_eq(old->entry.int_proxy_addr, addr)) {
+    old = NULL;
+  }
+  if(record) {
+    RCU_INIT_POINTER(record->next, old ? deref_locked(old->next) : deref_locked(*link));
+    rcu_assign_pointer(*link, record);
+  }
+  else if(old) {
+    rcu_assign_pointer(*link, deref_locked(old->next));
+  }
+  if(changed) {
+    smp_wmb(); // pairs with smp_rmb() in row_version(table)
+    WRITE_ONCE(row->version, ++table->version);
+  }
+  if(!old && record) {
+    page->count++;
+    table->sessions++;
+    set_bit(index, table->active);
+  }
+  else if(old && !record) {
+    if(!rcu_access_pointer(row->record)) {
+      clear_bit(index, table->active);
+    }
+    page->count--;
+    table->sessions--;
+    page_trim(table, index);
+  }
+  return old;
+}
+
+// remove a session, returns the cascaded peer of the old record
+static __be16 table_remove(struct table *table, __be16 index, struct in6_addr addr) {
+  __be16 peer = 0;
+  struct table_record *old;
+  spin_lock_bh(&table->lock);
+  old = row_publish(table, index, addr, NULL, true);
+  spin_unlock_bh(&table->lock);
+  if(old) {
+    peer = old->peer;
+    record_free(old);
+  }
+  return peer;
+}
+
+// recompile the routing of all sessions of a port without changing them
+static void table_recompile(struct table *table, __be16 index) {
+  struct table_page *page;
+  struct table_record __rcu **link;
+  struct table_record *old;
+  spin_lock_bh(&table->lock);
+  page = page_locked(index);
+  if(page) {
+    link = &page->rows[row_of(index)].record;
+    while((old = deref_locked(*link))) {
+      struct table_record *record = kmalloc(sizeof(*record), GFP_ATOMIC);
+      if(!record) {
+        debug_printk(BANNER "table_recompile: out of memory\n");
+        break;
+      }
+      // the state of a live session is never moved, only the sessions of a
+      // replaced table are, see table_adopt()
+      *record = *old;
+      precompile_routing(table, index, record);
+      rcu_assign_pointer(*link, record);
+      kfree_rcu(old, rcu);
+      link = &record->next;
+    }
+  }
+  spin_unlock_bh(&table->lock);
+}
+
+// whether a session of index in realm id is not on the current proxy
+// addresses of the realm
+static inline bool is_realm_moved(struct table_record *record, uint8_t id, struct realm *realm) {
+  return record->entry.realm == id &&
+    (!addr_eq(record->entry.int_proxy_addr, realm->int_proxy_addr) ||
+     !addr_eq(record->entry.ext_proxy_addr, realm->ext_proxy_addr));
+}
+
+// must be called with the table lock held, returns the first session of index
+// in realm id that is not on the current proxy addresses of the realm and can
+// move there, as no other session uses the new internal address of the port
+static struct table_record *realm_record_locked(struct table *table, __be16 index, uint8_t id, struct realm *realm) {
+  struct table_page *page = page_locked(index);
+  struct table_record *record = page ? deref_locked(page->rows[row_of(index)].record) : NULL;
+  for(; record; record = deref_locked(record->next)) {
+    if(is_realm_moved(record, id, realm)) {
+      struct table_record *taken = record_locked(table, index, realm->int_proxy_addr);
+      if(!taken || taken == record) {
+        return record;
+      }
+    }
+  }
+  return NULL;
+}
+
+// move the sessions of index in realm id to the proxy addresses of the realm,
+// a session whose new internal address is taken by another session of the
+// port stays where it is
+static void table_move_realm(struct table *table, __be16 index, uint8_t id, struct realm *realm) {
+  struct table_page *page;
+  struct table_record *old;
+  spin_lock_bh(&table->lock);
+  while((old = realm_record_locked(table, index, id, realm))) {
+    struct table_record *replaced;
+    struct table_record *record = kmalloc(sizeof(*record), GFP_ATOMIC);
+    if(!record) {
+      debug_printk(BANNER "table_move_realm: out of memory\n");
+      break;
+    }
+    *record = *old; // carries state_moved, which is false on live sessions
+    record->entry.int_proxy_addr = realm->int_proxy_addr;
+    record->entry.ext_proxy_addr = realm->ext_proxy_addr;
+    precompile_routing(table, index, record);
+    replaced = row_publish(table, index, realm->int_proxy_addr, record, true);
+    if(replaced != old) {
+      row_publish(table, index, old->entry.int_proxy_addr, NULL, true);
+    }
+    kfree_rcu(old, rcu);
+  }
+  page = page_locked(index);
+  for(old = page ? deref_locked(page->rows[row_of(index)].record) : NULL; old; old = deref_locked(old->next)) {
+    if(is_realm_moved(old, id, realm)) {
+      debug_printk(BANNER "table_move_realm: port %u is taken on the new address, session not moved\n", ntohs(index));
+    }
+  }
+  spin_unlock_bh(&table->lock);
+}
+
+// cascaded peers were compiled against the old entry of index
+static void table_recompile_peers(struct table *table, __be16 index, __be16 old_peer, __be16 new_peer) {
+  if(old_peer && old_peer != index) {
+    table_recompile(table, old_peer);
+  }
+  if(new_peer && new_peer != index && new_peer != old_peer) {
+    table_recompile(table, new_peer);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// table access
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void table_init(struct table *table, struct config_store *config) {
+  table->config = config;
+  spin_lock_init(&table->lock);
+  table_clr(table);
+}
+
+bool table_get(struct table *table, __be16 index, struct in6_addr addr, struct table_entry *entry) {
+  struct table_record *record;
+  rcu_read_lock();
+  for(record = record_get(table, index); record; record = rcu_dereference(record->next)) {
+    if(addr_eq(record->entry.int_proxy_addr, addr)) {
+      break;
+    }
+  }
+  if(record) {
+    *entry = record->entry;
+  }
+  else {
+    memset(entry, 0, sizeof(*entry));
+  }
+  rcu_read_unlock();
+  return is_entry_valid(entry);
+}
+
+bool table_get_at(struct table *table, __be16 index, int n, struct table_entry *entry) {
+  struct table_record *record;
+  rcu_read_lock();
+  for(record = record_get(table, index); record && n > 0; n--) {
+    record = rcu_dereference(record->next);
+  }
+  if(record) {
+    *entry = record->entry;
+  }
+  else {
+    memset(entry, 0, sizeof(*entry));
+  }
+  rcu_read_unlock();
+  return record != NULL;
+}
+
+int table_next(struct table *table, int index) {
+  index = find_next_bit(table->active, TABLE_SIZE, index + 1);
+  return index < TABLE_SIZE ? index : 0;
+}
+
+static inline void *put_function(struct table_entry *entry, void *arg) {
+  *entry = *(struct table_entry *)arg;
+  return arg;
+}
+
+void table_put(struct table *table, __be16 index, struct table_entry *entry) {
+  if(is_entry_valid(entry)) {
+    table_update(table, index, entry->int_proxy_addr, put_function, entry);
+  }
+  else {
+    table_del(table, index, entry->int_proxy_addr);
+  }
+}
+
+void table_del(struct table *table, __be16 index, struct in6_addr addr) {
+  __be16 old_peer = table_remove(table, index, addr);
+  table_sync_key(table);
+  table_recompile_peers(table, index, old_peer, 0);
+}
+
+// frees a detached page along with all of its sessions
+static void page_free(struct table_page *page) {
+  int r;
+  for(r = 0; r < TABLE_PAGE_SIZE && page->count; r++) {
+    struct table_record *old = rcu_dereference_protected(page->rows[r].record, 1);
+    while(old) {
+      struct table_record *next = rcu_dereference_protected(old->next, 1);
+      page->count--;
+      if(!old->state_moved) {
+        route_cache_clear(&old->state->routes);
+        kfree(old->state);
+      }
+      kfree(old);
+      old = next;
+    }
+  }
+  kfree(page);
+}
+
+// no reader can see a page detached by table_clr() after the grace period
+static void page_free_rcu(struct rcu_head *head) {
+  page_free(container_of(head, struct table_page, rcu));
+}
+
+// detach all pages from the table, returns them as a list
+static struct table_page *table_detach(struct table *table) {
+  struct table_page *detached = NULL;
+  int p;
+  spin_lock_bh(&table->lock);
+  for(p = 0; p < TABLE_PAGES; p++) {
+    struct table_page *page = deref_locked(table->pages[p]);
+    if(page) {
+      RCU_INIT_POINTER(table->pages[p], NULL);
+      page->next_free = detached;
+      detached = page;
+    }
+  }
+  bitmap_zero(table->active, TABLE_SIZE);
+  table->sessions = 0;
+  spin_unlock_bh(&table->lock);
+  return detached;
+}
+
+// only detaching the pages takes the lock, so a flush of a full table blocks
+// neither writers nor bottom halves for longer than an empty one
+void table_clr(struct table *table) {
+  struct table_page *detached = table_detach(table);
+  table_sync_key(table);
+  while(detached) {
+    struct table_page *page = detached;
+    detached = page->next_free;
+    call_rcu(&page->rcu, page_free_rcu);
+  }
+}
+
+void table_release(struct table *table) {
+  table->sessions = 0;
+  table_sync_key(table);
+}
+
+void table_destroy(struct table *table) {
+  struct table_page *detached = table_detach(table);
+  while(detached) {
+    struct table_page *page = detached;
+    detached = page->next_free;
+    page_free(page);
+  }
+}
+
+void table_adopt(struct table *table, struct table *from) {
+  int index = 0;
+  while((index = table_next(table, index))) {
+    struct table_page *page;
+    struct table_record *record;
+    spin_lock_bh(&table->lock);
+    page = page_locked(index);
+    record = page ? deref_locked(page->rows[row_of(index)].record) : NULL;
+    rcu_read_lock();
+    for(; record; record = deref_locked(record->next)) {
+      struct table_record *prev;
+      for(prev = record_get(from, index); prev; prev = rcu_dereference(prev->next)) {
+        if(addr_eq(prev->entry.int_proxy_addr, record->entry.int_proxy_addr)) {
+          break;
+        }
+      }
+      if(prev && !prev->state_moved) {
+        state_free(record->state);
+        record->state = prev->state;
+        prev->state_moved = true;
+      }
+    }
+    rcu_read_unlock();
+    spin_unlock_bh(&table->lock);
+  }
+  // the routing still refers to the replaced states
+  table_refresh(table);
+}
+
+void table_refresh(struct table *table) {
+  int index = 0;
+  while((index = table_next(table, index))) {
+    table_recompile(table, index);
+  }
+}
+
+void table_realm_changed(struct table *table, uint8_t id) {
+  struct realm realm;
+  int index = 0;
+  if(realm_get(table->config, id, &realm)) {
+    while((index = table_next(table, index))) {
+      table_move_realm(table, index, id, &realm);
+    }
+    // cascades may have been compiled against the old addresses
+    table_refresh(table);
+  }
+}
+
+void *table_update(struct table *table, __be16 index, struct in6_addr addr, table_function *fn, void *arg) {
+  if(fn) {
+    void *result = NULL;
+    __be16 old_peer = 0;
+    struct table_record *old;
+    struct table_record *record = kmalloc(sizeof(*record), GFP_KERNEL);
+    if(!record) {
+      debug_printk(BANNER "table_update: out of memory\n");
+      return NULL;
+    }
+    record->state_moved = false;
+    spin_lock_bh(&table->lock);
+    old = record_locked(table, index, addr);
+    if(old) {
+      record->entry = old->entry;
+      record->state = old->state;
+    }
+    else {
+      memset(&record->entry, 0, sizeof(record->entry));
+      record->state = page_ensure(table, index) ? state_new() : NULL;
+    }
+    result = record->state ? fn(&record->entry, arg) : NULL;
+    if(result) {
+      record->entry.int_proxy_addr = addr; // the key must not change
+      precompile_routing(table, index, record);
+      row_publish(table, index, addr, record, true);
+    }
+    else if(!old) {
+      page_trim(table, index);
+    }
+    spin_unlock_bh(&table->lock);
+    if(!result) {
+      if(!old) {
+        kfree(record->state);
+      }
+      kfree(record);
+    }
+    else {
+      if(old) {
+        old_peer = old->peer;
+        kfree_rcu(old, rcu);
+      }
+      table_sync_key(table);
+      table_recompile_peers(table, index, old_peer, record->peer);
+    }
+    return result;
+  }
+  else {
+    return NULL;
+  }
+}
+
+void *table_atomically(struct routing *routing, table_state_function *fn, void *arg) {
+  if(fn && routing->state) {
+    void *result = NULL;
+    spin_lock_bh(&routing->state->lock);
+    result = fn(routing->state, arg);
+    spin_unlock_bh(&routing->state->lock);
+    return result;
+  }
+  else {
+    return NULL;
+  }
+}
+
+// the clock only moves every few packets, so the state stays clean in between
+static inline void touch_state(struct table_state *state, unsigned long now) {
+  if(READ_ONCE(state->last_seen) != now) {
+    WRITE_ONCE(state->last_seen, now);
+  }
+}
+
+void table_touch(struct routing *routing, unsigned long now) {
+  if(routing->own_state) {
+    touch_state(routing->own_state, now);
+  }
+  if(routing->state && routing->state != routing->own_state) {
+    touch_state(routing->state, now); // keeps the cascaded peer alive
+  }
+}
+
+// the first session of index idle for more than timeout jiffies
+static bool idle_session(struct table *table, __be16 index, unsigned long now, unsigned long timeout, struct table_entry *entry) {
+  struct table_record *record;
+  rcu_read_lock();
+  for(record = record_get(table, index); record; record = rcu_dereference(record->next)) {
+    if(time_after(now, READ_ONCE(record->state->last_seen) + timeout)) {
+      *entry = record->entry;
+      break;
+    }
+  }
+  rcu_read_unlock();
+  return record != NULL;
+}
+
+int table_expire(struct table *table, unsigned long now, unsigned long timeout, table_expire_function *fn, void *arg) {
+  int count = 0;
+  int index = 0;
+  while((index = table_next(table, index))) {
+    struct table_entry entry;
+    while(idle_session(table, index, now, timeout, &entry)) {
+      table_del(table, index, entry.int_proxy_addr);
+      if(fn) {
+        fn(index, &entry, arg);
+      }
+      count++;
+    }
+  }
+  return count;
+}
+
+bool get_routing(struct table *table,
+                 __be16 index,
+                 struct in6_addr addr,
+                 struct in6_addr src_addr,
+                 __be16 src_port,
                  struct config *cfg,
                  struct table_entry *entry,
                  struct routing *routing) {
-  if(table_get(index, entry)) {
-    init_routing(index, cfg, entry, routing);
-    if(cfg->loopback && entry->sbc_addr == cfg->ext_proxy_addr) {
-      __be16 ind = entry->sbc_port;
-      struct table_entry ent;
-      if(table_get(ind, &ent)) {
-        struct routing tmp;
-        init_routing(ind, cfg, &ent, &tmp);
-
-        routing->e_prx_addr = tmp.i_prx_addr;
-        routing->e_prx_port = tmp.i_prx_port;
-        routing->e_src_addr = tmp.i_src_addr;
-        routing->e_src_port = tmp.i_src_port;
-        routing->e_dst_addr = tmp.i_dst_addr;
-        routing->e_dst_port = tmp.i_dst_port;
-      }
+  bool found = false;
+  struct table_record *record;
+  rcu_read_lock();
+  record = record_find(table, index, addr, src_addr, src_port, cfg);
+  if(record && is_entry_valid(&record->entry)) {
+    *entry = record->entry;
+    if(is_routing_current(table, record, cfg)) {
+      *routing = record->routing;
+    }
+    else {
+      compile_routing(table, index, cfg, record, routing);
     }
-    return true;
+    found = true;
   }
-  return false;
+  rcu_read_unlock();
+  return found;
 }
 
 #ifdef DEBUG
 void debug_print_routing(struct routing *rt) {
-  uint8_t  i_src_addr[4] = htoal(ntohl(rt->i_src_addr));
-  uint16_t i_src_port    = ntohs(rt->i_src_port);
-  uint8_t  i_dst_addr[4] = htoal(ntohl(rt->i_dst_addr));
-  uint16_t i_dst_port    = ntohs(rt->i_dst_port);
-  uint8_t  i_prx_addr[4] = htoal(ntohl(rt->i_prx_addr));
-  uint16_t i_prx_port    = ntohs(rt->i_prx_port);
-  uint8_t  e_prx_addr[4] = htoal(ntohl(rt->e_prx_addr));
-  uint16_t e_prx_port    = ntohs(rt->e_prx_port);
-  uint8_t  e_src_addr[4] = htoal(ntohl(rt->e_src_addr));
-  uint16_t e_src_port    = ntohs(rt->e_src_port);
-  uint8_t  e_dst_addr[4] = htoal(ntohl(rt->e_dst_addr));
-  uint16_t e_dst_port    = ntohs(rt->e_dst_port);
+  char i_src_addr[ADDR_STR_SIZE], i_dst_addr[ADDR_STR_SIZE];
+  char i_prx_addr[ADDR_STR_SIZE], e_prx_addr[ADDR_STR_SIZE];
+  char e_src_addr[ADDR_STR_SIZE], e_dst_addr[ADDR_STR_SIZE];
+  uint16_t i_src_port = ntohs(rt->i_src_port);
+  uint16_t i_dst_port = ntohs(rt->i_dst_port);
+  uint16_t i_prx_port = ntohs(rt->i_prx_port);
+  uint16_t e_prx_port = ntohs(rt->e_prx_port);
+  uint16_t e_src_port = ntohs(rt->e_src_port);
+  uint16_t e_dst_port = ntohs(rt->e_dst_port);
+
+  addr_str(i_src_addr, rt->i_src_addr);
+  addr_str(i_dst_addr, rt->i_dst_addr);
+  addr_str(i_prx_addr, rt->i_prx_addr);
+  addr_str(e_prx_addr, rt->e_prx_addr);
+  addr_str(e_src_addr, rt->e_src_addr);
+  addr_str(e_dst_addr, rt->e_dst_addr);
 
   if(rt->loopback) {
     printk(BANNER "ROUTING (loopback)\n");
@@ -185,15 +896,11 @@ void debug_print_routing(struct routing *rt) {
     printk(BANNER "ROUTING\n");
   }
 
-  printk(BANNER "=> ("IP_PORT_FMT" -> "IP_PORT_FMT") ~> ("IP_PORT_FMT" -> "IP_PORT_FMT")\n",
-         i_src_addr[0],i_src_addr[1],i_src_addr[2],i_src_addr[3],i_src_port,
-         i_prx_addr[0],i_prx_addr[1],i_prx_addr[2],i_prx_addr[3],i_prx_port,
-         e_prx_addr[0],e_prx_addr[1],e_prx_addr[2],e_prx_addr[3],e_prx_port,
-         e_dst_addr[0],e_dst_addr[1],e_dst_addr[2],e_dst_addr[3],e_dst_port);
-  printk(BANNER " < ("IP_PORT_FMT" -> "IP_PORT_FMT") ~> ("IP_PORT_FMT" -> "IP_PORT_FMT")\n",
-         e_src_addr[0],e_src_addr[1],e_src_addr[2],e_src_addr[3],e_src_port,
-         e_prx_addr[0],e_prx_addr[1],e_prx_addr[2],e_prx_addr[3],e_prx_port,
-         i_prx_addr[0],i_prx_addr[1],i_prx_addr[2],i_prx_addr[3],i_prx_port,
-         i_dst_addr[0],i_dst_addr[1],i_dst_addr[2],i_dst_addr[3],i_dst_port);
+  printk(BANNER "=> (%s:"PORT_FMT" -> %s:"PORT_FMT") ~> (%s:"PORT_FMT" -> %s:"PORT_FMT")\n",
+         i_src_addr, i_src_port, i_prx_addr, i_prx_port,
+         e_prx_addr, e_prx_port, e_dst_addr, e_dst_port);
+  printk(BANNER " < (%s:"PORT_FMT" -> %s:"PORT_FMT") ~> (%s:"PORT_FMT" -> %s:"PORT_FMT")\n",
+         e_src_addr, e_src_port, e_prx_addr, e_prx_port,
+         i_prx_addr, i_prx_port, i_dst_addr, i_dst_port);
 }
 #endif
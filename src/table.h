@@ -18,66 +18,175 @@
 #ifndef _TABLE_H_
 #define _TABLE_H_
 
+#ifdef __KERNEL__
+#include <linux/jiffies.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#endif
+
 #include "module.h"
 
 #include "config.h"
+#include "route.h"
 
 #include "debug.h"
 
+// read-mostly routing data of a session, see addr.h for the addresses
 struct table_entry {
-  __be32 sender_addr;
-  __be16 sender_port;
+  struct in6_addr sender_addr;
+  struct in6_addr receiver_addr;
+  struct in6_addr sbc_addr;
 
-  __be32 receiver_addr;
-  __be16 receiver_port;
+  // proxy addresses of the session, none for the configured ones, together
+  // with the port the internal proxy address identifies the session
+  struct in6_addr int_proxy_addr;
+  struct in6_addr ext_proxy_addr;
 
-  __be32 sbc_addr;
+  __be16 sender_port;
+  __be16 receiver_port;
   __be16 sbc_port;
 
+  // realm the proxy addresses above are taken from, or 0
+  uint8_t realm;
+};
+
+// per-session RTP state written for every RTP packet, kept on its own cache
+// line so that sequence number updates do not dirty the routing data
+struct table_state {
+  spinlock_t lock;
   uint16_t last_sn;
-  uint16_t offset;
-  uint8_t offset_set;
+  uint16_t offset; // random for new sessions
   uint8_t entry_used;
-};
+  unsigned long last_seen; // jiffies of the last packet
+  struct route_cache routes;
+  struct rcu_head rcu;
+} ____cacheline_aligned_in_smp;
 
 struct routing {
-  __be32 i_src_addr;
+  struct in6_addr i_src_addr;
   __be16 i_src_port;
-  __be32 i_dst_addr;
+  struct in6_addr i_dst_addr;
   __be16 i_dst_port;
 
-  __be32 i_prx_addr;
+  struct in6_addr i_prx_addr;
   __be16 i_prx_port;
-  __be32 e_prx_addr;
+  struct in6_addr e_prx_addr;
   __be16 e_prx_port;
 
-  __be32 e_src_addr;
+  struct in6_addr e_src_addr;
   __be16 e_src_port;
-  __be32 e_dst_addr;
+  struct in6_addr e_dst_addr;
   __be16 e_dst_port;
 
   uint8_t loopback;
 
   uint8_t smoothing;
+
+  // the internal and the external side are of different IP versions, packets
+  // get translated when they are relayed (see translate.h)
+  uint8_t interworking;
+
+  // RTP state of the session owning E_PRX_PORT and state of the session
+  // itself, they differ for cascades, only valid in the RCU read side critical
+  // section the routing was looked up in
+  struct table_state *state;
+  struct table_state *own_state;
 };
 
 #define TABLE_SIZE 65536
 
-void table_init(void);
+#define TABLE_PAGE_BITS 8
+#define TABLE_PAGE_SIZE (1 << TABLE_PAGE_BITS)
+#define TABLE_PAGES     (TABLE_SIZE / TABLE_PAGE_SIZE)
+
+struct table_page;
+
+// the sessions of one proxy instance, routed according to its config
+struct table {
+  spinlock_t lock; // serializes writers
+  uint32_t version; // source of row versions, never reused
+  struct table_page __rcu *pages[TABLE_PAGES];
+  DECLARE_BITMAP(active, TABLE_SIZE);
+  int sessions;   // number of sessions
+  bool populated; // counted in sessions_key
+  struct config_store *config;
+};
+
+// enabled as long as any table holds sessions, so the hooks cost nothing on
+// nodes without any
+DECLARE_STATIC_KEY_FALSE(sessions_key);
+
+#define sessions_exist() static_branch_unlikely(&sessions_key)
 
-bool table_get(__be16 index, struct table_entry *entry);
+void table_init(struct table *table, struct config_store *config);
 
-void table_put(__be16 index, struct table_entry *entry);
+// get the session of index with internal proxy address addr
+bool table_get(struct table *table, __be16 index, struct in6_addr addr, struct table_entry *entry);
 
-void table_del(__be16 index);
+// get the n-th session of index
+bool table_get_at(struct table *table, __be16 index, int n, struct table_entry *entry);
 
-void table_clr(void);
+// next index after index that holds an entry, or 0 if there is none
+int table_next(struct table *table, int index);
+
+// cheap check whether index may hold a session, without a lookup, for
+// rejecting packets early
+static inline bool table_has(struct table *table, __be16 index) {
+  return test_bit(index, table->active);
+}
+
+void table_put(struct table *table, __be16 index, struct table_entry *entry);
+
+void table_del(struct table *table, __be16 index, struct in6_addr addr);
+
+void table_clr(struct table *table);
+
+// stop counting the table in sessions_key, before it gets destroyed, as
+// table_destroy() may run where the key cannot be changed
+void table_release(struct table *table);
+
+// free all sessions at once, no reader may see the table any more
+void table_destroy(struct table *table);
+
+// take over the RTP state of the sessions that are in from as well, so that
+// sequence numbers continue when table replaces from. The hooks must not see
+// table yet and neither table may change meanwhile, the states stay with
+// table when from gets freed.
+void table_adopt(struct table *table, struct table *from);
+
+// recompile the routing of all entries, required after config changes
+void table_refresh(struct table *table);
+
+// move the sessions of a realm to its current proxy addresses
+void table_realm_changed(struct table *table, uint8_t realm);
 
 typedef void *table_function(struct table_entry *entry, void *arg);
 
-void *table_atomically(__be16 index, table_function *fn, void *arg);
+// replace the entry by a copy modified by fn, a NULL result keeps the old entry
+void *table_update(struct table *table, __be16 index, struct in6_addr addr, table_function *fn, void *arg);
+
+typedef void *table_state_function(struct table_state *state, void *arg);
+
+// modify the RTP state of a looked up routing under its lock
+void *table_atomically(struct routing *routing, table_state_function *fn, void *arg);
+
+// record a packet on a looked up routing at jiffies now
+void table_touch(struct routing *routing, unsigned long now);
+
+typedef void table_expire_function(__be16 index, struct table_entry *entry, void *arg);
+
+// remove the sessions without packets for more than timeout jiffies and pass
+// each to fn, returns the number of removed sessions
+int table_expire(struct table *table, unsigned long now, unsigned long timeout, table_expire_function *fn, void *arg);
 
-bool get_routing(__be16 index,
+// look up the routing of the session of index a packet from
+// src_addr:src_port to addr belongs to, an unset source matches any session
+bool get_routing(struct table *table,
+                 __be16 index,
+                 struct in6_addr addr,
+                 struct in6_addr src_addr,
+                 __be16 src_port,
                  struct config *cfg,
                  struct table_entry *entry,
                  struct routing *routing);
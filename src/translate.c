@@ -0,0 +1,176 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "translate.h"
+
+#include <linux/version.h>
+#include <net/ip.h>
+#include <net/ip6_route.h>
+#include <net/ipv6.h>
+#include <net/route.h>
+
+#include "checksum.h"
+#include "route.h"
+#include "debug.h"
+
+#if IS_ENABLED(CONFIG_IPV6)
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// header translation, the UDP header and the payload stay where they are
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// the packet is a new one for the stack of the other IP version
+static inline void translate_done(struct sk_buff *skb) {
+  // skb->csum covered the old IP header
+  if(skb->ip_summed == CHECKSUM_COMPLETE) {
+    skb->ip_summed = CHECKSUM_NONE;
+  }
+  skb_dst_drop(skb);
+}
+
+bool translate_to_ipv6(struct sk_buff *skb, struct in6_addr saddr, struct in6_addr daddr) {
+  const struct iphdr *ip_header = ip_hdr(skb);
+  unsigned int ihl = ip_hdrlen(skb);
+  unsigned int len = ntohs(ip_header->tot_len) - ihl;
+  uint8_t tclass = ip_header->tos;
+  uint8_t ttl = ip_header->ttl;
+  __be32 v4_saddr = ip_header->saddr;
+  __be32 v4_daddr = ip_header->daddr;
+  struct ipv6hdr *ip6_header;
+  // the IPv6 header is longer, unless there are many options
+  if(ttl <= 1 || ip_is_fragment(ip_header) ||
+     skb_cow_head(skb, ihl < sizeof(struct ipv6hdr) ? sizeof(struct ipv6hdr) - ihl : 0)) {
+    return false;
+  }
+  checksum_pseudo_to_ipv6(skb, (struct udphdr *)(skb->data + ihl), v4_saddr, v4_daddr, saddr, daddr);
+  skb_pull(skb, ihl);
+  skb_push(skb, sizeof(struct ipv6hdr));
+  skb_reset_network_header(skb);
+  skb_set_transport_header(skb, sizeof(struct ipv6hdr));
+  ip6_header = ipv6_hdr(skb);
+  ip6_flow_hdr(ip6_header, tclass, 0);
+  ip6_header->payload_len = htons(len);
+  ip6_header->nexthdr = IPPROTO_UDP;
+  ip6_header->hop_limit = ttl - 1;
+  ip6_header->saddr = saddr;
+  ip6_header->daddr = daddr;
+  skb->protocol = htons(ETH_P_IPV6);
+  memset(IP6CB(skb), 0, sizeof(struct inet6_skb_parm));
+  translate_done(skb);
+  return true;
+}
+
+bool translate_to_ipv4(struct sk_buff *skb, __be32 saddr, __be32 daddr) {
+  const struct ipv6hdr *ip6_header = ipv6_hdr(skb);
+  unsigned int len = ntohs(ip6_header->payload_len);
+  uint8_t tclass = ipv6_get_dsfield(ip6_header);
+  uint8_t hop_limit = ip6_header->hop_limit;
+  struct in6_addr v6_saddr = ip6_header->saddr;
+  struct in6_addr v6_daddr = ip6_header->daddr;
+  struct iphdr *ip_header;
+  if(hop_limit <= 1 || len + sizeof(struct iphdr) > 0xffff) {
+    return false;
+  }
+  checksum_pseudo_to_ipv4(skb, (struct udphdr *)(skb->data + sizeof(struct ipv6hdr)), v6_saddr, v6_daddr, saddr, daddr);
+  skb_pull(skb, sizeof(struct ipv6hdr));
+  skb_push(skb, sizeof(struct iphdr));
+  skb_reset_network_header(skb);
+  skb_set_transport_header(skb, sizeof(struct iphdr));
+  ip_header = ip_hdr(skb);
+  ip_header->version = 4;
+  ip_header->ihl = sizeof(struct iphdr) / 4;
+  ip_header->tos = tclass;
+  ip_header->tot_len = htons(len + sizeof(struct iphdr));
+  // atomic datagram (RFC 6864), the IPv6 side cannot fragment on the way
+  ip_header->id = 0;
+  ip_header->frag_off = htons(IP_DF);
+  ip_header->ttl = hop_limit - 1;
+  ip_header->protocol = IPPROTO_UDP;
+  ip_header->saddr = saddr;
+  ip_header->daddr = daddr;
+  ip_send_check(ip_header);
+  skb->protocol = htons(ETH_P_IP);
+  memset(IPCB(skb), 0, sizeof(struct inet_skb_parm));
+  translate_done(skb);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// output, on a route looked up for each packet
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static struct dst_entry *translate_route(struct net *net, struct sk_buff *skb) {
+  if(skb->protocol == htons(ETH_P_IP)) {
+    const struct iphdr *ip_header = ip_hdr(skb);
+    struct flowi4 fl4;
+    struct rtable *rt;
+    memset(&fl4, 0, sizeof(fl4));
+    fl4.daddr = ip_header->daddr;
+    fl4.saddr = ip_header->saddr;
+    fl4.flowi4_proto = IPPROTO_UDP;
+    fl4.flowi4_mark = skb->mark;
+    rt = ip_route_output_key(net, &fl4);
+    if(IS_ERR(rt)) {
+      return NULL;
+    }
+    if(rt->rt_type != RTN_UNICAST) {
+      ip_rt_put(rt);
+      return NULL;
+    }
+    return &rt->dst;
+  }
+  else {
+    const struct ipv6hdr *ip6_header = ipv6_hdr(skb);
+    struct flowi6 fl6;
+    struct dst_entry *dst;
+    memset(&fl6, 0, sizeof(fl6));
+    fl6.daddr = ip6_header->daddr;
+    fl6.saddr = ip6_header->saddr;
+    fl6.flowi6_proto = IPPROTO_UDP;
+    fl6.flowi6_mark = skb->mark;
+    dst = ip6_route_output(net, NULL, &fl6);
+    if(dst->error) {
+      dst_release(dst);
+      return NULL;
+    }
+    return dst;
+  }
+}
+
+bool translate_output(struct net *net, struct sk_buff *skb) {
+  struct dst_entry *dst = translate_route(net, skb);
+  if(!dst) {
+    debug_printk(BANNER "translate_output: no route\n");
+    return false;
+  }
+  // the sender of the other IP version cannot be told to send smaller packets
+  if(skb->len > dst_mtu(dst)) {
+    debug_printk(BANNER "translate_output: packet exceeds the MTU\n");
+    dst_release(dst);
+    return false;
+  }
+  skb_dst_set(skb, dst);
+  // the POST_ROUTING hooks of the proxy let the translated packet pass
+  route_transmit(net, skb);
+  return true;
+}
+
+#endif
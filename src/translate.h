@@ -0,0 +1,47 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TRANSLATE_H_
+#define _TRANSLATE_H_
+
+#ifdef __KERNEL__
+#include <linux/ipv6.h>
+#include <linux/skbuff.h>
+#include <net/net_namespace.h>
+#endif
+
+#include "module.h"
+#include "addr.h"
+
+// IPv4/IPv6 interworking (NAT46/64) of relayed UDP packets: the IP header of
+// a packet is replaced by one of the other IP version, and the UDP checksum
+// follows the addresses of the pseudo header. IP options and the flow label
+// get lost, the traffic class is kept. The network header must be at
+// skb->data, as in PRE_ROUTING, and the packet must not be GSO.
+
+#if IS_ENABLED(CONFIG_IPV6)
+// IPv4 -> IPv6, false if the packet has to be dropped
+bool translate_to_ipv6(struct sk_buff *skb, struct in6_addr saddr, struct in6_addr daddr);
+
+// IPv6 -> IPv4, false if the packet has to be dropped
+bool translate_to_ipv4(struct sk_buff *skb, __be32 saddr, __be32 daddr);
+
+// route and transmit a translated packet, false if it has to be dropped
+bool translate_output(struct net *net, struct sk_buff *skb);
+#endif
+
+#endif // _TRANSLATE_H_
@@ -0,0 +1,192 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "tests.h"
+
+#include <time.h>
+
+#include "../src/rtp_packet.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// checksum benchmark: per packet, rewrite what the proxy rewrites (source and
+// destination address and port, RTP sequence number) and fix the IP and UDP
+// checksums, once by recomputing them over header and payload, once by RFC
+// 1624 incremental updates. Both have to agree on every packet.
+//
+// The kernel provides the checksum primitives to the module, these are
+// portable equivalents of csum_partial() and inet_proto_csum_replace*().
+//
+
+#define PACKETS (1024 * 1024)
+
+struct packet {
+  struct iphdr ip;
+  struct udphdr udp;
+  struct rtp_packet rtp;
+  uint8_t payload[9000];
+} __attribute__((packed));
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t sum16(const void *data, int len, uint32_t sum) {
+  const uint16_t *p = data;
+  for(; len > 1; len -= 2) {
+    sum += *p++;
+  }
+  if(len) {
+    sum += *(const uint8_t *)p;
+  }
+  return sum;
+}
+
+static uint16_t fold(uint32_t sum) {
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+static void full_checksums(struct packet *packet) {
+  uint16_t len = ntohs(packet->udp.len);
+  uint32_t sum = 0;
+  packet->ip.check = 0;
+  packet->ip.check = fold(sum16(&packet->ip, sizeof(packet->ip), 0));
+  sum = sum16(&packet->ip.saddr, 8, sum);
+  sum += htons(IPPROTO_UDP);
+  sum += packet->udp.len;
+  packet->udp.check = 0;
+  packet->udp.check = fold(sum16(&packet->udp, len, sum));
+  if(!packet->udp.check) {
+    packet->udp.check = 0xffff;
+  }
+}
+
+// HC' = ~(~HC + ~m + m')
+static uint16_t replace2(uint16_t check, uint16_t from, uint16_t to) {
+  return fold((uint16_t)~check + (uint16_t)~from + to);
+}
+
+static uint16_t replace4(uint16_t check, uint32_t from, uint32_t to) {
+  check = replace2(check, from >> 16, to >> 16);
+  return replace2(check, from & 0xffff, to & 0xffff);
+}
+
+// the header fields are packed, they are passed by value and the new value is
+// returned for the caller to store
+static uint32_t set_addr(struct packet *packet, uint32_t from, uint32_t to) {
+  packet->ip.check = replace4(packet->ip.check, from, to);
+  packet->udp.check = replace4(packet->udp.check, from, to);
+  return to;
+}
+
+static uint16_t set_be16(struct packet *packet, uint16_t from, uint16_t to) {
+  packet->udp.check = replace2(packet->udp.check, from, to);
+  return to;
+}
+
+static void rewrite(struct packet *packet, int i, bool incremental) {
+  uint32_t saddr = htonl(0x0a000001 + i);
+  uint32_t daddr = htonl(0xc0a80001 + i);
+  uint16_t sport = htons(30000 + i);
+  uint16_t dport = htons(40000 + i);
+  uint16_t sn = htons(i);
+  if(incremental) {
+    packet->ip.saddr = set_addr(packet, packet->ip.saddr, saddr);
+    packet->ip.daddr = set_addr(packet, packet->ip.daddr, daddr);
+    packet->udp.source = set_be16(packet, packet->udp.source, sport);
+    packet->udp.dest = set_be16(packet, packet->udp.dest, dport);
+    packet->rtp.SN = set_be16(packet, packet->rtp.SN, sn);
+    if(!packet->udp.check) {
+      packet->udp.check = 0xffff;
+    }
+  }
+  else {
+    packet->ip.saddr = saddr;
+    packet->ip.daddr = daddr;
+    packet->udp.source = sport;
+    packet->udp.dest = dport;
+    packet->rtp.SN = sn;
+    full_checksums(packet);
+  }
+}
+
+static void setup(struct packet *packet, int payload) {
+  int i;
+  memset(packet, 0, sizeof(*packet));
+  packet->ip.version = 4;
+  packet->ip.ihl = 5;
+  packet->ip.ttl = 64;
+  packet->ip.protocol = IPPROTO_UDP;
+  packet->ip.tot_len = htons(sizeof(struct iphdr) + sizeof(struct udphdr) + sizeof(struct rtp_packet) + payload);
+  packet->udp.len = htons(sizeof(struct udphdr) + sizeof(struct rtp_packet) + payload);
+  packet->rtp.V = 2;
+  for(i = 0; i < payload; i++) {
+    packet->payload[i] = i * 7;
+  }
+  full_checksums(packet);
+}
+
+static void checksum_bench(int payload) {
+  static struct packet full, incremental;
+  double start, full_elapsed, incremental_elapsed;
+  int i;
+
+  setup(&full, payload);
+  setup(&incremental, payload);
+  for(i = 0; i < 1024; i++) {
+    rewrite(&full, i, false);
+    rewrite(&incremental, i, true);
+    if(full.ip.check != incremental.ip.check || full.udp.check != incremental.udp.check) {
+      printf("BUG checksums differ at payload %d packet %d: ip %04hx/%04hx udp %04hx/%04hx\n", payload, i,
+             full.ip.check, incremental.ip.check, full.udp.check, incremental.udp.check);
+      exit(-1);
+    }
+  }
+
+  start = now();
+  for(i = 0; i < PACKETS; i++) {
+    rewrite(&full, i, false);
+  }
+  full_elapsed = now() - start;
+
+  start = now();
+  for(i = 0; i < PACKETS; i++) {
+    rewrite(&incremental, i, true);
+  }
+  incremental_elapsed = now() - start;
+
+  printf("checksums: %4d bytes payload: full %.1f nsec/packet, incremental %.1f nsec/packet (%04hx %04hx)\n",
+         payload, full_elapsed / PACKETS * 1e9, incremental_elapsed / PACKETS * 1e9,
+         full.udp.check, incremental.udp.check);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// main function
+//
+
+int main(int argc, char **argv) {
+  checksum_bench(0);
+  checksum_bench(160);  // G.711, 20 ms
+  checksum_bench(1200); // video
+  checksum_bench(8960); // jumbo frame
+  exit(0);
+}
@@ -19,21 +19,110 @@
 
 #include "../src/config.h"
 
+static struct config_store config;
+
 static void new_config_is_all_zero_test(void) {
   struct config cfg;
-  config_get(&cfg);
-  bool is_non_zero = cfg.int_proxy_addr || cfg.ext_proxy_addr;
+  config_get(&config, &cfg);
+  bool is_non_zero = addr_is_set(cfg.int_proxy_addr) || addr_is_set(cfg.ext_proxy_addr);
   if(is_non_zero) {
-    printf("BUG %hu %hu\n",
-           cfg.int_proxy_addr, cfg.ext_proxy_addr);
+    printf("BUG %u %u\n",
+           ntohl(addr_to_v4(cfg.int_proxy_addr)), ntohl(addr_to_v4(cfg.ext_proxy_addr)));
+    exit(-1);
+  }
+}
+
+static void realm_test(void) {
+  struct realm realm;
+  uint8_t a = realm_set(&config, "a", addr_v4(htonl(0x01010101)), addr_v4(htonl(0x02020202)));
+  uint8_t b = realm_set(&config, "b", addr_v4(htonl(0x03030303)), addr_v4(htonl(0x04040404)));
+  if(!a || !b || a == b || realm_find(&config, "a") != a || realm_find(&config, "b") != b || realm_find(&config, "c")) {
+    printf("BUG realm ids %hhu %hhu\n", a, b);
+    exit(-1);
+  }
+  if(realm_set(&config, "a", addr_v4(htonl(0x05050505)), addr_v4(htonl(0x06060606))) != a ||
+     !realm_get(&config, a, &realm) ||
+     !addr_eq(realm.int_proxy_addr, addr_v4(htonl(0x05050505))) ||
+     !addr_eq(realm.ext_proxy_addr, addr_v4(htonl(0x06060606)))) {
+    printf("BUG realm update\n");
+    exit(-1);
+  }
+  config_clr(&config);
+  if(realm_find(&config, "a") || realm_get(&config, a, &realm)) {
+    printf("BUG realm not flushed\n");
+    exit(-1);
+  }
+}
+
+static void feature_key_test(void) {
+  static struct config_store other;
+  struct config cfg;
+  config_init(&other);
+  if(!smoothing_enabled() || !loopback_enabled()) {
+    printf("BUG features of new configs not enabled\n");
+    exit(-1);
+  }
+  config_get(&config, &cfg);
+  cfg.smoothing = 0;
+  config_set(&config, &cfg);
+  if(!smoothing_enabled()) {
+    printf("BUG smoothing disabled while still in use\n");
+    exit(-1);
+  }
+  config_destroy(&other);
+  if(smoothing_enabled() || !loopback_enabled()) {
+    printf("BUG smoothing still enabled\n");
+    exit(-1);
+  }
+  config_clr(&config);
+  if(!smoothing_enabled()) {
+    printf("BUG smoothing not enabled again\n");
+    exit(-1);
+  }
+}
+
+static void notrack_key_test(void) {
+  struct config cfg;
+  config_get(&config, &cfg);
+  if(cfg.notrack || notrack_enabled()) {
+    printf("BUG notrack enabled by default\n");
+    exit(-1);
+  }
+  cfg.notrack = 1;
+  config_set(&config, &cfg);
+  if(!notrack_enabled()) {
+    printf("BUG notrack not enabled\n");
+    exit(-1);
+  }
+  config_clr(&config);
+  if(notrack_enabled()) {
+    printf("BUG notrack still enabled\n");
+    exit(-1);
+  }
+}
+
+static void checksum_policy_test(void) {
+  uint8_t policy;
+  for(policy = 0; policy < CHECKSUM_POLICIES; policy++) {
+    if(checksum_policy_find(checksum_policy_name(policy)) != policy) {
+      printf("BUG checksum policy %hhu\n", policy);
+      exit(-1);
+    }
+  }
+  if(checksum_policy_find("none") != CHECKSUM_POLICIES || checksum_policy_name(CHECKSUM_POLICIES)) {
+    printf("BUG unknown checksum policy\n");
     exit(-1);
   }
 }
 
 int main(int argc, char **argv) {
-  config_init();
+  config_init(&config);
 
   new_config_is_all_zero_test();
+  realm_test();
+  feature_key_test();
+  notrack_key_test();
+  checksum_policy_test();
 
   printf(KGRN"SUCCESS"KNRM"\n");
   exit(0);
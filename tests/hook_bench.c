@@ -0,0 +1,213 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "tests.h"
+
+#include <time.h>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// hook dispatch benchmark: per packet, get from the netfilter hook into the
+// rewrite of that hook, once like a single generic hook function does, with an
+// indirect call through the hook's ops and runtime checks of the hook number,
+// once like the specialized hook functions do, with the hook number known at
+// compile time and a direct call. Both have to agree on every packet.
+//
+// Built with retpolines if the compiler supports them, like kernels with
+// CONFIG_RETPOLINE are, where every indirect call goes through a thunk.
+//
+
+#define PACKETS (64 * 1024 * 1024)
+
+enum {HOOK_PRE_ROUTING, HOOK_LOCAL_IN, HOOK_LOCAL_OUT, HOOK_POST_ROUTING, HOOKS};
+
+struct packet {
+  uint32_t saddr;
+  uint16_t sport;
+  uint16_t sn;
+};
+
+typedef unsigned int rewrite_fn(struct packet *packet);
+
+struct hook {
+  int hooknum;
+  rewrite_fn *fn;
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static __attribute__((noinline)) unsigned int pre_route(struct packet *packet) {
+  packet->saddr ^= 0x01010101;
+  return 1;
+}
+
+static __attribute__((noinline)) unsigned int local_in(struct packet *packet) {
+  packet->sport += 2;
+  return 1;
+}
+
+static __attribute__((noinline)) unsigned int local_out(struct packet *packet) {
+  packet->sn += 1;
+  return 1;
+}
+
+static __attribute__((noinline)) unsigned int post_route(struct packet *packet) {
+  packet->saddr ^= 0x02020202;
+  return 1;
+}
+
+// the steps the generic hook function runs for some hooks only
+static __attribute__((noinline)) void incoming(struct packet *packet) {
+  packet->sn ^= 0x0100;
+}
+
+static __attribute__((noinline)) void outgoing(struct packet *packet) {
+  packet->sport ^= 0x0100;
+}
+
+static struct hook hooks[HOOKS] = {
+  { .hooknum = HOOK_PRE_ROUTING,  .fn = pre_route,  },
+  { .hooknum = HOOK_LOCAL_IN,     .fn = local_in,   },
+  { .hooknum = HOOK_LOCAL_OUT,    .fn = local_out,  },
+  { .hooknum = HOOK_POST_ROUTING, .fn = post_route, },
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// generic dispatch: one hook function for all hooks
+//
+
+static __attribute__((noinline)) unsigned int generic_hook(void *priv, struct packet *packet, int hooknum) {
+  struct hook *hook = priv;
+  unsigned int verdict;
+  if(hooknum == HOOK_PRE_ROUTING || hooknum == HOOK_LOCAL_OUT) {
+    incoming(packet);
+  }
+  verdict = hook->fn(packet);
+  if(hooknum == HOOK_LOCAL_OUT) {
+    outgoing(packet);
+  }
+  return verdict;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// specialized dispatch: one hook function per hook
+//
+
+static inline __attribute__((always_inline)) unsigned int hook_func(struct packet *packet,
+                                                                    const int hooknum, rewrite_fn *fn) {
+  unsigned int verdict;
+  if(hooknum == HOOK_PRE_ROUTING || hooknum == HOOK_LOCAL_OUT) {
+    incoming(packet);
+  }
+  verdict = fn(packet);
+  if(hooknum == HOOK_LOCAL_OUT) {
+    outgoing(packet);
+  }
+  return verdict;
+}
+
+static __attribute__((noinline)) unsigned int pre_routing_hook(struct packet *packet) {
+  return hook_func(packet, HOOK_PRE_ROUTING, pre_route);
+}
+
+static __attribute__((noinline)) unsigned int local_in_hook(struct packet *packet) {
+  return hook_func(packet, HOOK_LOCAL_IN, local_in);
+}
+
+static __attribute__((noinline)) unsigned int local_out_hook(struct packet *packet) {
+  return hook_func(packet, HOOK_LOCAL_OUT, local_out);
+}
+
+static __attribute__((noinline)) unsigned int post_routing_hook(struct packet *packet) {
+  return hook_func(packet, HOOK_POST_ROUTING, post_route);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// benchmark, every packet passes PRE_ROUTING and POST_ROUTING of a forwarded
+// packet, every eighth LOCAL_OUT and LOCAL_IN like looped back ones do
+//
+
+static struct packet packet_at(int i) {
+  struct packet packet = { .saddr = i, .sport = i, .sn = i };
+  return packet;
+}
+
+static uint32_t packet_sum(struct packet *packet) {
+  return packet->saddr + packet->sport + packet->sn;
+}
+
+// the indirect call netfilter makes into the registered hook function
+static unsigned int (*volatile nf_hook)(void *priv, struct packet *packet, int hooknum) = generic_hook;
+
+static double generic_bench(uint32_t *checksum) {
+  double start = now();
+  int i;
+  for(i = 0; i < PACKETS; i++) {
+    struct packet packet = packet_at(i);
+    nf_hook(&hooks[HOOK_PRE_ROUTING], &packet, HOOK_PRE_ROUTING);
+    if(!(i & 7)) {
+      nf_hook(&hooks[HOOK_LOCAL_OUT], &packet, HOOK_LOCAL_OUT);
+      nf_hook(&hooks[HOOK_LOCAL_IN], &packet, HOOK_LOCAL_IN);
+    }
+    nf_hook(&hooks[HOOK_POST_ROUTING], &packet, HOOK_POST_ROUTING);
+    *checksum += packet_sum(&packet);
+  }
+  return now() - start;
+}
+
+static double specialized_bench(uint32_t *checksum) {
+  double start = now();
+  int i;
+  for(i = 0; i < PACKETS; i++) {
+    struct packet packet = packet_at(i);
+    pre_routing_hook(&packet);
+    if(!(i & 7)) {
+      local_out_hook(&packet);
+      local_in_hook(&packet);
+    }
+    post_routing_hook(&packet);
+    *checksum += packet_sum(&packet);
+  }
+  return now() - start;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// main function
+//
+
+int main(int argc, char **argv) {
+  uint32_t generic = 0, specialized = 0;
+  double generic_elapsed = generic_bench(&generic);
+  double specialized_elapsed = specialized_bench(&specialized);
+
+  printf("hook dispatch: %d packets: generic %.2f nsec/packet, specialized %.2f nsec/packet (checksum %u)\n",
+         PACKETS, generic_elapsed / PACKETS * 1e9, specialized_elapsed / PACKETS * 1e9, specialized);
+  if(generic != specialized) {
+    printf("hook dispatch: checksums differ (%u != %u)\n", generic, specialized);
+    exit(1);
+  }
+
+  exit(0);
+}
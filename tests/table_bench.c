@@ -0,0 +1,161 @@
+/**
+ * Copyright (C) 2015  Lindenbaum GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "tests.h"
+
+#include <time.h>
+
+#include "../src/table.h"
+#include "../src/config.h"
+
+static struct config_store config;
+static struct table table;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// packet path benchmark: per packet, do what the netfilter hooks do with the
+// table, i.e. look up the routing and update the RTP sequence number state
+//
+
+#define SESSIONS 4096
+#define PACKETS  (16 * 1024 * 1024)
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *sn_function(struct table_state *state, void *arg) {
+  uint16_t *sn = arg;
+  state->last_sn = *sn;
+  *sn += state->offset;
+  return arg;
+}
+
+static void setup(void) {
+  struct config cfg;
+  int i;
+  config_get(&config, &cfg);
+  cfg.int_proxy_addr = addr_v4(htonl(0x01010101));
+  cfg.ext_proxy_addr = addr_v4(htonl(0x02020202));
+  config_set(&config, &cfg);
+
+  for(i = 0; i < SESSIONS; i++) {
+    struct table_entry ent = {
+      .sender_addr   = addr_v4(htonl(0xc0a86408)),
+      .sender_port   = htons(10000 + 2 * i),
+      .receiver_addr = addr_v4(htonl(0xc0a86408)),
+      .receiver_port = htons(10000 + 2 * i),
+      .sbc_addr      = addr_v4(htonl(0xd51ef1be)),
+      .sbc_port      = htons(20000 + 2 * i),
+    };
+    table_put(&table, htons(30000 + 2 * i), &ent);
+  }
+}
+
+static void packet_path_bench(void) {
+  uint32_t checksum = 0;
+  double start, elapsed;
+  int i;
+
+  start = now();
+  for(i = 0; i < PACKETS; i++) {
+    struct config cfg;
+    struct table_entry ent;
+    struct routing rt;
+    __be16 index = htons(30000 + 2 * (i % SESSIONS));
+    uint16_t sn = i;
+    config_get(&config, &cfg);
+    if(get_routing(&table, index, ADDR_NONE, ADDR_NONE, 0, &cfg, &ent, &rt)) {
+      table_atomically(&rt, sn_function, &sn);
+      checksum += addr_to_v4(rt.e_dst_addr) + sn;
+    }
+  }
+  elapsed = now() - start;
+
+  printf("packet path: %d packets, %d sessions: %.0f packets/sec (checksum %u)\n",
+         PACKETS, SESSIONS, PACKETS / elapsed, checksum);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// flush and init benchmark: table_clr() runs on live tables from the "f"
+// command, table_init() for every new network namespace
+//
+
+#define ROUNDS 16
+
+static void fill(int sessions) {
+  int i;
+  for(i = 0; i < sessions; i++) {
+    struct table_entry ent = {
+      .sender_addr   = addr_v4(htonl(0xc0a86408)),
+      .sender_port   = htons(10000),
+      .receiver_addr = addr_v4(htonl(0xc0a86408)),
+      .receiver_port = htons(10000),
+      .sbc_addr      = addr_v4(htonl(0xd51ef1be)),
+      .sbc_port      = htons(20000),
+    };
+    table_put(&table, htons(i + 1), &ent);
+  }
+}
+
+static void flush_bench(int sessions) {
+  double elapsed = 0;
+  int i;
+  for(i = 0; i < ROUNDS; i++) {
+    double start;
+    fill(sessions);
+    start = now();
+    table_clr(&table);
+    elapsed += now() - start;
+  }
+  printf("flush: %d sessions: %.1f usec\n", sessions, elapsed / ROUNDS * 1e6);
+}
+
+static void init_bench(void) {
+  double start, elapsed;
+  int i;
+  start = now();
+  for(i = 0; i < ROUNDS; i++) {
+    table_init(&table, &config);
+  }
+  elapsed = now() - start;
+  printf("init: %.1f usec\n", elapsed / ROUNDS * 1e6);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// main function
+//
+
+int main(int argc, char **argv) {
+  config_init(&config);
+  table_init(&table, &config);
+
+  setup();
+  packet_path_bench();
+
+  table_clr(&table);
+  flush_bench(0);
+  flush_bench(4096);
+  flush_bench(TABLE_SIZE - 1);
+  init_bench();
+
+  exit(0);
+}
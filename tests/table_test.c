@@ -20,6 +20,9 @@
 #include "../src/table.h"
 #include "../src/config.h"
 
+static struct config_store config;
+static struct table table;
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // helper functions
@@ -27,9 +30,9 @@
 
 void dump_config(void) {
   struct config cfg;
-  config_get(&cfg);
-  uint8_t int_proxy_ip[4] = htoal(ntohl(cfg.int_proxy_addr));
-  uint8_t ext_proxy_ip[4] = htoal(ntohl(cfg.ext_proxy_addr));
+  config_get(&config, &cfg);
+  uint8_t int_proxy_ip[4] = htoal(ntohl(addr_to_v4(cfg.int_proxy_addr)));
+  uint8_t ext_proxy_ip[4] = htoal(ntohl(addr_to_v4(cfg.ext_proxy_addr)));
   uint8_t smoothing = cfg.smoothing;
   uint8_t loopback = cfg.loopback;
   printf("config:" " int_proxy_addr: "IP_FMT " ext_proxy_addr: "IP_FMT" smoothing: "U8_FMT" loopback: "U8_FMT"\n",
@@ -40,32 +43,32 @@ void dump_config(void) {
 
 static void set_config(uint8_t int_proxy_ip[4], uint8_t ext_proxy_ip[4]) {
   struct config cfg;
-  config_get(&cfg);
-  cfg.int_proxy_addr = htonl(atohl(int_proxy_ip));
-  cfg.ext_proxy_addr = htonl(atohl(ext_proxy_ip));
-  config_set(&cfg);
+  config_get(&config, &cfg);
+  cfg.int_proxy_addr = addr_v4(htonl(atohl(int_proxy_ip)));
+  cfg.ext_proxy_addr = addr_v4(htonl(atohl(ext_proxy_ip)));
+  config_set(&config, &cfg);
 }
 
 void dump_table(void) {
   struct config cfg;
-  config_get(&cfg);
+  config_get(&config, &cfg);
   int index;
   printf("TABLE\n");
   for(index = 0; index < TABLE_SIZE; index++) {
     struct table_entry ent;
-    bool contains_entry = table_get(index, &ent);
+    bool contains_entry = table_get(&table, index, ADDR_NONE, &ent);
     if(contains_entry) {
-      uint8_t int_proxy_ip[4] = htoal(ntohl(cfg.int_proxy_addr));
-      uint8_t ext_proxy_ip[4] = htoal(ntohl(cfg.ext_proxy_addr));
+      uint8_t int_proxy_ip[4] = htoal(ntohl(addr_to_v4(cfg.int_proxy_addr)));
+      uint8_t ext_proxy_ip[4] = htoal(ntohl(addr_to_v4(cfg.ext_proxy_addr)));
       uint16_t proxy_port = ntohs(index);
 
-      uint8_t sender_ip[4] = htoal(ntohl(ent.sender_addr));
+      uint8_t sender_ip[4] = htoal(ntohl(addr_to_v4(ent.sender_addr)));
       uint16_t sender_port = ntohs(ent.sender_port);
 
-      uint8_t receiver_ip[4] = htoal(ntohl(ent.receiver_addr));
+      uint8_t receiver_ip[4] = htoal(ntohl(addr_to_v4(ent.receiver_addr)));
       uint16_t receiver_port = ntohs(ent.receiver_port);
 
-      uint8_t sbc_ip[4] = htoal(ntohl(ent.sbc_addr));
+      uint8_t sbc_ip[4] = htoal(ntohl(addr_to_v4(ent.sbc_addr)));
       uint16_t sbc_port = ntohs(ent.sbc_port);
 
       printf("=> ("IP_PORT_FMT" -> "IP_PORT_FMT") ~> ("IP_PORT_FMT" -> "IP_PORT_FMT")\n",
@@ -83,17 +86,17 @@ void dump_table(void) {
 }
 
 void dump_routing(struct routing *rt) {
-  uint8_t  i_src_addr[4] = htoal(ntohl(rt->i_src_addr));
+  uint8_t  i_src_addr[4] = htoal(ntohl(addr_to_v4(rt->i_src_addr)));
   uint16_t i_src_port    = ntohs(rt->i_src_port);
-  uint8_t  i_dst_addr[4] = htoal(ntohl(rt->i_dst_addr));
+  uint8_t  i_dst_addr[4] = htoal(ntohl(addr_to_v4(rt->i_dst_addr)));
   uint16_t i_dst_port    = ntohs(rt->i_dst_port);
-  uint8_t  i_prx_addr[4] = htoal(ntohl(rt->i_prx_addr));
+  uint8_t  i_prx_addr[4] = htoal(ntohl(addr_to_v4(rt->i_prx_addr)));
   uint16_t i_prx_port    = ntohs(rt->i_prx_port);
-  uint8_t  e_prx_addr[4] = htoal(ntohl(rt->e_prx_addr));
+  uint8_t  e_prx_addr[4] = htoal(ntohl(addr_to_v4(rt->e_prx_addr)));
   uint16_t e_prx_port    = ntohs(rt->e_prx_port);
-  uint8_t  e_src_addr[4] = htoal(ntohl(rt->e_src_addr));
+  uint8_t  e_src_addr[4] = htoal(ntohl(addr_to_v4(rt->e_src_addr)));
   uint16_t e_src_port    = ntohs(rt->e_src_port);
-  uint8_t  e_dst_addr[4] = htoal(ntohl(rt->e_dst_addr));
+  uint8_t  e_dst_addr[4] = htoal(ntohl(addr_to_v4(rt->e_dst_addr)));
   uint16_t e_dst_port    = ntohs(rt->e_dst_port);
 
   if(rt->loopback) {
@@ -121,17 +124,17 @@ static void add_route(uint16_t prx_port,
   __be16 key = htons(prx_port);
 
   struct table_entry ent = {
-    .sender_addr = htonl(atohl(snd_ip)),
+    .sender_addr = addr_v4(htonl(atohl(snd_ip))),
     .sender_port = htons(snd_port),
 
-    .receiver_addr = htonl(atohl(rcv_ip)),
+    .receiver_addr = addr_v4(htonl(atohl(rcv_ip))),
     .receiver_port = htons(rcv_port),
 
-    .sbc_addr = htonl(atohl(sbc_ip)),
+    .sbc_addr = addr_v4(htonl(atohl(sbc_ip))),
     .sbc_port = htons(sbc_port),
   };
 
-  table_put(key, &ent);
+  table_put(&table, key, &ent);
 }
 
 static void assert_route(uint16_t prx_port,
@@ -142,21 +145,21 @@ static void assert_route(uint16_t prx_port,
                          uint8_t rcv_ip[4], uint16_t rcv_port,
                          char *FILE, int LINE) {
   struct config cfg;
-  config_get(&cfg);
+  config_get(&config, &cfg);
   __be16 key = htons(prx_port);
   struct table_entry ent;
-  if(table_get(key, &ent)) {
+  if(table_get(&table, key, ADDR_NONE, &ent)) {
 
-    assert_equals(atohl(snd_ip),     ntohl(ent.sender_addr),    FILE, LINE);
+    assert_equals(atohl(snd_ip),     ntohl(addr_to_v4(ent.sender_addr)),    FILE, LINE);
     assert_equals(snd_port,          ntohs(ent.sender_port),    FILE, LINE);
 
-    assert_equals(atohl(int_prx_ip), ntohl(cfg.int_proxy_addr), FILE, LINE);
-    assert_equals(atohl(ext_prx_ip), ntohl(cfg.ext_proxy_addr), FILE, LINE);
+    assert_equals(atohl(int_prx_ip), ntohl(addr_to_v4(cfg.int_proxy_addr)), FILE, LINE);
+    assert_equals(atohl(ext_prx_ip), ntohl(addr_to_v4(cfg.ext_proxy_addr)), FILE, LINE);
 
-    assert_equals(atohl(sbc_ip),     ntohl(ent.sbc_addr),       FILE, LINE);
+    assert_equals(atohl(sbc_ip),     ntohl(addr_to_v4(ent.sbc_addr)),       FILE, LINE);
     assert_equals(sbc_port,          ntohs(ent.sbc_port),       FILE, LINE);
 
-    assert_equals(atohl(rcv_ip),     ntohl(ent.receiver_addr),  FILE, LINE);
+    assert_equals(atohl(rcv_ip),     ntohl(addr_to_v4(ent.receiver_addr)),  FILE, LINE);
     assert_equals(rcv_port,          ntohs(ent.receiver_port),  FILE, LINE);
 
     return;
@@ -175,29 +178,29 @@ static void assert_route_cascading(uint16_t prx_port,
                                    uint8_t dst_2_ip[4], uint16_t dst_2_port,
                                    char *FILE, int LINE) {
   struct config cfg;
-  config_get(&cfg);
+  config_get(&config, &cfg);
   __be16 key = htons(prx_port);
   struct table_entry ent;
   struct routing rt;
-  if(get_routing(key, &cfg, &ent, &rt)) {
+  if(get_routing(&table, key, ADDR_NONE, ADDR_NONE, 0, &cfg, &ent, &rt)) {
     dump_routing(&rt);
-    assert_equals(atohl(src_1_ip),  ntohl(rt.i_src_addr), FILE, LINE);
+    assert_equals(atohl(src_1_ip),  ntohl(addr_to_v4(rt.i_src_addr)), FILE, LINE);
     assert_equals(      src_1_port, ntohs(rt.i_src_port), FILE, LINE);
-    assert_equals(atohl(dst_2_ip),  ntohl(rt.i_dst_addr), FILE, LINE);
+    assert_equals(atohl(dst_2_ip),  ntohl(addr_to_v4(rt.i_dst_addr)), FILE, LINE);
     assert_equals(      dst_2_port, ntohs(rt.i_dst_port), FILE, LINE);
 
-    assert_equals(atohl(int_1_ip),  ntohl(rt.i_prx_addr), FILE, LINE);
-    assert_equals(atohl(int_2_ip),  ntohl(rt.i_prx_addr), FILE, LINE);
+    assert_equals(atohl(int_1_ip),  ntohl(addr_to_v4(rt.i_prx_addr)), FILE, LINE);
+    assert_equals(atohl(int_2_ip),  ntohl(addr_to_v4(rt.i_prx_addr)), FILE, LINE);
 
     assert_equals(      prx_port,   ntohs(rt.i_prx_port), FILE, LINE);
     assert_equals(      int_2_port, ntohs(rt.i_prx_port), FILE, LINE);
 
-    assert_equals(atohl(ext_1_ip),  ntohl(rt.e_prx_addr), FILE, LINE);
-    assert_equals(atohl(ext_2_ip),  ntohl(rt.e_prx_addr), FILE, LINE);
+    assert_equals(atohl(ext_1_ip),  ntohl(addr_to_v4(rt.e_prx_addr)), FILE, LINE);
+    assert_equals(atohl(ext_2_ip),  ntohl(addr_to_v4(rt.e_prx_addr)), FILE, LINE);
 
-    assert_equals(atohl(src_2_ip),  ntohl(rt.e_src_addr), FILE, LINE);
+    assert_equals(atohl(src_2_ip),  ntohl(addr_to_v4(rt.e_src_addr)), FILE, LINE);
     assert_equals(      src_2_port, ntohs(rt.e_src_port), FILE, LINE);
-    assert_equals(atohl(dst_1_ip),  ntohl(rt.e_dst_addr), FILE, LINE);
+    assert_equals(atohl(dst_1_ip),  ntohl(addr_to_v4(rt.e_dst_addr)), FILE, LINE);
     assert_equals(      dst_1_port, ntohs(rt.e_dst_port), FILE, LINE);
 
     return;
@@ -213,16 +216,16 @@ static void assert_route_cascading(uint16_t prx_port,
 
 static void new_table_contains_no_entries_test(void) {
   struct config cfg;
-  config_get(&cfg);
+  config_get(&config, &cfg);
   int index;
   for(index = 0; index < TABLE_SIZE; index++) {
     struct table_entry ent;
-    bool contains_entry = table_get(index, &ent);
+    bool contains_entry = table_get(&table, index, ADDR_NONE, &ent);
     if(contains_entry) {
       printf(KRED"BUG"KNRM" %d %hu %hhu %hu %hhu %hu %hhu\n", index,
-             ent.sender_addr, ent.sender_port,
-             ent.receiver_addr, ent.receiver_port,
-             ent.sbc_addr, ent.sbc_port);
+             addr_to_v4(ent.sender_addr), ent.sender_port,
+             addr_to_v4(ent.receiver_addr), ent.receiver_port,
+             addr_to_v4(ent.sbc_addr), ent.sbc_port);
       exit(-1);
     }
   }
@@ -360,11 +363,11 @@ static void short_circuiting_test(void) {
   dump_table();
 
   struct config cfg;
-  config_get(&cfg);
+  config_get(&config, &cfg);
   __be16 key = htons(prx_port);
   struct table_entry ent;
   struct routing rt;
-  if(get_routing(key, &cfg, &ent, &rt)) {
+  if(get_routing(&table, key, ADDR_NONE, ADDR_NONE, 0, &cfg, &ent, &rt)) {
     dump_routing(&rt);
   }
   else {
@@ -373,15 +376,592 @@ static void short_circuiting_test(void) {
   }
 }
 
+static void assert_proxy_addrs(uint16_t prx_port,
+                               uint8_t int_prx_ip[4],
+                               uint8_t ext_prx_ip[4],
+                               char *FILE, int LINE) {
+  struct config cfg;
+  config_get(&config, &cfg);
+  __be16 key = htons(prx_port);
+  struct table_entry ent;
+  struct routing rt;
+  if(get_routing(&table, key, ADDR_NONE, ADDR_NONE, 0, &cfg, &ent, &rt)) {
+    assert_equals(atohl(int_prx_ip), ntohl(addr_to_v4(rt.i_prx_addr)), FILE, LINE);
+    assert_equals(atohl(ext_prx_ip), ntohl(addr_to_v4(rt.e_prx_addr)), FILE, LINE);
+    return;
+  }
+  exit(-1);
+}
+
+static void config_change_test(void) {
+  uint8_t int_ip[4] = INT_PROXY_IP;
+  uint8_t ext_ip[4] = EXT_PROXY_IP;
+  uint8_t prx_ip[4] = PROXY_IP;
+
+  set_config(int_ip, ext_ip);
+
+  uint16_t prx_port  = 32768;
+
+  uint8_t  snd_ip[4] = MEDIA_IP;
+  uint16_t snd_port  = 18562;
+
+  uint8_t  rcv_ip[4] = MEDIA_IP;
+  uint16_t rcv_port  = 18560;
+
+  uint8_t sbc_ip[4]  = SBC_IP;
+  uint16_t sbc_port  = 40960;
+
+  add_route(prx_port,
+            snd_ip, snd_port,
+            rcv_ip, rcv_port,
+            sbc_ip, sbc_port);
+
+  assert_proxy_addrs(prx_port, int_ip, ext_ip, __FILE__, __LINE__);
+
+  // precompiled routing is outdated, but must not be used
+  set_config(prx_ip, prx_ip);
+  assert_proxy_addrs(prx_port, prx_ip, prx_ip, __FILE__, __LINE__);
+
+  table_refresh(&table);
+  assert_proxy_addrs(prx_port, prx_ip, prx_ip, __FILE__, __LINE__);
+}
+
+static void table_next_test(void) {
+  uint8_t snd_ip[4] = MEDIA_IP;
+  uint8_t rcv_ip[4] = MEDIA_IP;
+  uint8_t sbc_ip[4] = SBC_IP;
+  uint16_t ports[] = { 2, 254, 256, 32768, 65534, };
+  int i, index = 0;
+
+  for(i = 0; i < sizeof(ports) / sizeof(ports[0]); i++) {
+    add_route(ntohs(ports[i]), snd_ip, 18562, rcv_ip, 18560, sbc_ip, 40960);
+  }
+  for(i = 0; i < sizeof(ports) / sizeof(ports[0]); i++) {
+    index = table_next(&table, index);
+    assert_equals(ports[i], index, __FILE__, __LINE__);
+  }
+  assert_equals(0, table_next(&table, index), __FILE__, __LINE__);
+
+  table_del(&table, ports[1], ADDR_NONE);
+  table_del(&table, ports[2], ADDR_NONE);
+  assert_equals(ports[3], table_next(&table, ports[0]), __FILE__, __LINE__);
+  assert_equals(true, table_has(&table, ports[0]), __FILE__, __LINE__);
+  assert_equals(false, table_has(&table, ports[1]), __FILE__, __LINE__);
+  assert_equals(false, table_has(&table, ports[0] + 1), __FILE__, __LINE__);
+
+  table_clr(&table);
+  assert_equals(0, table_next(&table, 0), __FILE__, __LINE__);
+  assert_equals(false, table_has(&table, ports[0]), __FILE__, __LINE__);
+}
+
+static void assert_session_from(uint16_t prx_port, __be32 addr,
+                                __be32 src_addr, uint16_t src_port,
+                                uint8_t int_prx_ip[4],
+                                uint8_t ext_prx_ip[4],
+                                uint16_t sbc_port,
+                                char *FILE, int LINE) {
+  struct config cfg;
+  config_get(&config, &cfg);
+  __be16 key = htons(prx_port);
+  struct table_entry ent;
+  struct routing rt;
+  if(get_routing(&table, key, addr_v4(addr), src_addr ? addr_v4(src_addr) : ADDR_NONE, htons(src_port),
+                 &cfg, &ent, &rt)) {
+    assert_equals(atohl(int_prx_ip), ntohl(addr_to_v4(rt.i_prx_addr)), FILE, LINE);
+    assert_equals(atohl(ext_prx_ip), ntohl(addr_to_v4(rt.e_prx_addr)), FILE, LINE);
+    assert_equals(sbc_port,          ntohs(rt.e_dst_port), FILE, LINE);
+    return;
+  }
+  exit(-1);
+}
+
+static void assert_session(uint16_t prx_port, __be32 addr,
+                           uint8_t int_prx_ip[4],
+                           uint8_t ext_prx_ip[4],
+                           uint16_t sbc_port,
+                           char *FILE, int LINE) {
+  assert_session_from(prx_port, addr, 0, 0, int_prx_ip, ext_prx_ip, sbc_port, FILE, LINE);
+}
+
+static void shared_port_test(void) {
+  uint8_t int_ip[4] = INT_PROXY_IP;
+  uint8_t ext_ip[4] = EXT_PROXY_IP;
+  uint8_t prx_ip[4] = PROXY_IP;
+  uint8_t snd_ip[4] = MEDIA_IP;
+  uint8_t sbc_ip[4] = SBC_IP;
+  uint8_t other_sbc_ip[4] = {213, 30, 241, 191};
+
+  set_config(int_ip, ext_ip);
+
+  uint16_t prx_port = 32768;
+  __be16 key = htons(prx_port);
+
+  // one session on the configured proxy addresses, one on PROXY_IP
+  add_route(prx_port, snd_ip, 18562, snd_ip, 18560, sbc_ip, 40960);
+  struct table_entry ent = {
+    .sender_addr    = addr_v4(htonl(atohl(snd_ip))),
+    .sender_port    = htons(18572),
+    .receiver_addr  = addr_v4(htonl(atohl(snd_ip))),
+    .receiver_port  = htons(18570),
+    .sbc_addr       = addr_v4(htonl(atohl(other_sbc_ip))),
+    .sbc_port       = htons(40970),
+    .int_proxy_addr = addr_v4(htonl(atohl(prx_ip))),
+    .ext_proxy_addr = addr_v4(htonl(atohl(prx_ip))),
+  };
+  table_put(&table, key, &ent);
+
+  dump_table();
+
+  // lookup by proxy address, i.e. before the destination got rewritten
+  assert_session(prx_port, htonl(atohl(int_ip)), int_ip, ext_ip, 40960, __FILE__, __LINE__);
+  assert_session(prx_port, htonl(atohl(ext_ip)), int_ip, ext_ip, 40960, __FILE__, __LINE__);
+  assert_session(prx_port, htonl(atohl(prx_ip)), prx_ip, prx_ip, 40970, __FILE__, __LINE__);
+
+  // lookup by rewritten destination address
+  assert_session(prx_port, htonl(atohl(sbc_ip)), int_ip, ext_ip, 40960, __FILE__, __LINE__);
+  assert_session(prx_port, htonl(atohl(other_sbc_ip)), prx_ip, prx_ip, 40970, __FILE__, __LINE__);
+
+  // sessions are distinct
+  assert_equals(true, table_get_at(&table, key, 1, &ent), __FILE__, __LINE__);
+  assert_equals(false, table_get_at(&table, key, 2, &ent), __FILE__, __LINE__);
+
+  table_del(&table, key, ADDR_NONE);
+  assert_equals(false, table_get(&table, key, ADDR_NONE, &ent), __FILE__, __LINE__);
+  assert_equals(true, table_get(&table, key, addr_v4(htonl(atohl(prx_ip))), &ent), __FILE__, __LINE__);
+  assert_session(prx_port, 0, prx_ip, prx_ip, 40970, __FILE__, __LINE__);
+
+  table_del(&table, key, addr_v4(htonl(atohl(prx_ip))));
+  assert_equals(0, table_next(&table, 0), __FILE__, __LINE__);
+}
+
+static void shared_sbc_test(void) {
+  uint8_t int_ip[4] = INT_PROXY_IP;
+  uint8_t ext_ip[4] = EXT_PROXY_IP;
+  uint8_t prx_ip[4] = PROXY_IP;
+  uint8_t snd_ip[4] = MEDIA_IP;
+  uint8_t sbc_ip[4] = SBC_IP;
+
+  set_config(int_ip, ext_ip);
+
+  uint16_t prx_port = 32768;
+  __be16 key = htons(prx_port);
+
+  // two sessions on different proxy addresses, with the same receiver and
+  // behind the same SBC
+  add_route(prx_port, snd_ip, 18562, snd_ip, 18560, sbc_ip, 40960);
+  struct table_entry ent = {
+    .sender_addr    = addr_v4(htonl(atohl(snd_ip))),
+    .sender_port    = htons(18572),
+    .receiver_addr  = addr_v4(htonl(atohl(snd_ip))),
+    .receiver_port  = htons(18570),
+    .sbc_addr       = addr_v4(htonl(atohl(sbc_ip))),
+    .sbc_port       = htons(40970),
+    .int_proxy_addr = addr_v4(htonl(atohl(prx_ip))),
+    .ext_proxy_addr = addr_v4(htonl(atohl(prx_ip))),
+  };
+  table_put(&table, key, &ent);
+
+  // after routing, to the SBC from the senders of the sessions
+  assert_session_from(prx_port, htonl(atohl(sbc_ip)), htonl(atohl(snd_ip)), 18562,
+                      int_ip, ext_ip, 40960, __FILE__, __LINE__);
+  assert_session_from(prx_port, htonl(atohl(sbc_ip)), htonl(atohl(snd_ip)), 18572,
+                      prx_ip, prx_ip, 40970, __FILE__, __LINE__);
+
+  // after routing, to the receiver from the SBC ports of the sessions
+  assert_session_from(prx_port, htonl(atohl(snd_ip)), htonl(atohl(sbc_ip)), 40960,
+                      int_ip, ext_ip, 40960, __FILE__, __LINE__);
+  assert_session_from(prx_port, htonl(atohl(snd_ip)), htonl(atohl(sbc_ip)), 40970,
+                      prx_ip, prx_ip, 40970, __FILE__, __LINE__);
+
+  table_del(&table, key, ADDR_NONE);
+  table_del(&table, key, addr_v4(htonl(atohl(prx_ip))));
+  assert_equals(0, table_next(&table, 0), __FILE__, __LINE__);
+}
+
+// 2001:db8::<last>
+static struct in6_addr addr6(uint8_t last) {
+  struct in6_addr addr = ADDR_NONE;
+  addr.s6_addr[0] = 0x20;
+  addr.s6_addr[1] = 0x01;
+  addr.s6_addr[2] = 0x0d;
+  addr.s6_addr[3] = 0xb8;
+  addr.s6_addr[15] = last;
+  return addr;
+}
+
+static void assert_session6(uint16_t prx_port, struct in6_addr addr,
+                            struct in6_addr int_prx_addr,
+                            struct in6_addr ext_prx_addr,
+                            uint16_t sbc_port,
+                            char *FILE, int LINE) {
+  struct config cfg;
+  config_get(&config, &cfg);
+  struct table_entry ent;
+  struct routing rt;
+  if(get_routing(&table, htons(prx_port), addr, ADDR_NONE, 0, &cfg, &ent, &rt)) {
+    assert_equals(true,     addr_eq(int_prx_addr, rt.i_prx_addr), FILE, LINE);
+    assert_equals(true,     addr_eq(ext_prx_addr, rt.e_prx_addr), FILE, LINE);
+    assert_equals(sbc_port, ntohs(rt.e_dst_port), FILE, LINE);
+    return;
+  }
+  exit(-1);
+}
+
+static void ipv6_session_test(void) {
+  uint8_t int_ip[4] = INT_PROXY_IP;
+  uint8_t ext_ip[4] = EXT_PROXY_IP;
+  uint8_t snd_ip[4] = MEDIA_IP;
+  uint8_t sbc_ip[4] = SBC_IP;
+
+  set_config(int_ip, ext_ip);
+
+  uint16_t prx_port = 32768;
+  __be16 key = htons(prx_port);
+
+  // an IPv4 session on the configured proxy addresses, an IPv6 one beside it
+  add_route(prx_port, snd_ip, 18562, snd_ip, 18560, sbc_ip, 40960);
+  struct table_entry ent = {
+    .sender_addr    = addr6(0x10),
+    .sender_port    = htons(18572),
+    .receiver_addr  = addr6(0x10),
+    .receiver_port  = htons(18570),
+    .sbc_addr       = addr6(0x20),
+    .sbc_port       = htons(40970),
+    .int_proxy_addr = addr6(0x01),
+    .ext_proxy_addr = addr6(0x02),
+  };
+  table_put(&table, key, &ent);
+
+  struct in6_addr int_addr = addr_v4(htonl(atohl(int_ip)));
+  struct in6_addr ext_addr = addr_v4(htonl(atohl(ext_ip)));
+
+  // lookup by proxy address and by rewritten destination address
+  assert_session6(prx_port, int_addr, int_addr, ext_addr, 40960, __FILE__, __LINE__);
+  assert_session6(prx_port, addr6(0x01), addr6(0x01), addr6(0x02), 40970, __FILE__, __LINE__);
+  assert_session6(prx_port, addr6(0x02), addr6(0x01), addr6(0x02), 40970, __FILE__, __LINE__);
+  assert_session6(prx_port, addr6(0x20), addr6(0x01), addr6(0x02), 40970, __FILE__, __LINE__);
+
+  // IPv4 addresses are mapped, none of them matches an IPv6 address
+  assert_equals(true, addr_is_v4(int_addr), __FILE__, __LINE__);
+  assert_equals(false, addr_is_v4(addr6(0x01)), __FILE__, __LINE__);
+  assert_equals(0, addr_to_v4(addr6(0x01)), __FILE__, __LINE__);
+  assert_equals(false, table_get(&table, key, addr_v4(htonl(0x00000001)), &ent), __FILE__, __LINE__);
+
+  table_del(&table, key, addr6(0x01));
+  assert_equals(false, table_get(&table, key, addr6(0x01), &ent), __FILE__, __LINE__);
+  assert_equals(true, table_get(&table, key, ADDR_NONE, &ent), __FILE__, __LINE__);
+
+  table_del(&table, key, ADDR_NONE);
+  assert_equals(0, table_next(&table, 0), __FILE__, __LINE__);
+}
+
+static void interworking_test(void) {
+  uint8_t int_ip[4] = INT_PROXY_IP;
+  uint8_t ext_ip[4] = EXT_PROXY_IP;
+  uint8_t snd_ip[4] = MEDIA_IP;
+  uint8_t sbc_ip[4] = SBC_IP;
+
+  set_config(int_ip, ext_ip);
+
+  struct config cfg;
+  config_get(&config, &cfg);
+  struct table_entry ent;
+  struct routing rt;
+
+  // IPv4 only
+  add_route(32768, snd_ip, 18562, snd_ip, 18560, sbc_ip, 40960);
+  assert_equals(true, get_routing(&table, htons(32768), ADDR_NONE, ADDR_NONE, 0, &cfg, &ent, &rt), __FILE__, __LINE__);
+  assert_equals(0, rt.interworking, __FILE__, __LINE__);
+
+  // IPv6 internal side, IPv4 external side
+  struct table_entry mixed = {
+    .sender_addr    = addr6(0x10),
+    .sender_port    = htons(18572),
+    .receiver_addr  = addr6(0x10),
+    .receiver_port  = htons(18570),
+    .sbc_addr       = addr_v4(htonl(atohl(sbc_ip))),
+    .sbc_port       = htons(40970),
+    .int_proxy_addr = addr6(0x01),
+    .ext_proxy_addr = addr_v4(htonl(atohl(ext_ip))),
+  };
+  table_put(&table, htons(32770), &mixed);
+  assert_equals(true, get_routing(&table, htons(32770), ADDR_NONE, ADDR_NONE, 0, &cfg, &ent, &rt), __FILE__, __LINE__);
+  assert_equals(1, rt.interworking, __FILE__, __LINE__);
+  assert_equals(true, addr_eq(addr6(0x10), rt.i_dst_addr), __FILE__, __LINE__);
+  assert_equals(atohl(sbc_ip), ntohl(addr_to_v4(rt.e_dst_addr)), __FILE__, __LINE__);
+
+  table_clr(&table);
+}
+
+static void realm_test(void) {
+  uint8_t int_ip[4] = INT_PROXY_IP;
+  uint8_t ext_ip[4] = EXT_PROXY_IP;
+  uint8_t prx_ip[4] = PROXY_IP;
+  uint8_t snd_ip[4] = MEDIA_IP;
+  uint8_t sbc_ip[4] = SBC_IP;
+  uint8_t other_ip[4] = {10, 1, 40, 122};
+
+  set_config(int_ip, ext_ip);
+
+  uint16_t prx_port = 32768;
+  __be16 key = htons(prx_port);
+
+  uint8_t id = realm_set(&config, "carrier", addr_v4(htonl(atohl(prx_ip))), addr_v4(htonl(atohl(prx_ip))));
+  struct realm realm;
+  realm_get(&config, id, &realm);
+
+  add_route(prx_port, snd_ip, 18562, snd_ip, 18560, sbc_ip, 40960);
+  struct table_entry ent = {
+    .sender_addr    = addr_v4(htonl(atohl(snd_ip))),
+    .sender_port    = htons(18572),
+    .receiver_addr  = addr_v4(htonl(atohl(snd_ip))),
+    .receiver_port  = htons(18570),
+    .sbc_addr       = addr_v4(htonl(atohl(sbc_ip))),
+    .sbc_port       = htons(40970),
+    .int_proxy_addr = realm.int_proxy_addr,
+    .ext_proxy_addr = realm.ext_proxy_addr,
+    .realm          = id,
+  };
+  table_put(&table, key, &ent);
+
+  assert_session(prx_port, htonl(atohl(int_ip)), int_ip, ext_ip, 40960, __FILE__, __LINE__);
+  assert_session(prx_port, htonl(atohl(prx_ip)), prx_ip, prx_ip, 40970, __FILE__, __LINE__);
+
+  // the session moves along with its realm, others stay where they are
+  realm_set(&config, "carrier", addr_v4(htonl(atohl(other_ip))), addr_v4(htonl(atohl(ext_ip))));
+  table_realm_changed(&table, id);
+
+  dump_table();
+
+  assert_equals(false, table_get(&table, key, addr_v4(htonl(atohl(prx_ip))), &ent), __FILE__, __LINE__);
+  assert_equals(true, table_get(&table, key, addr_v4(htonl(atohl(other_ip))), &ent), __FILE__, __LINE__);
+  assert_session(prx_port, htonl(atohl(int_ip)), int_ip, ext_ip, 40960, __FILE__, __LINE__);
+  assert_session(prx_port, htonl(atohl(other_ip)), other_ip, ext_ip, 40970, __FILE__, __LINE__);
+  assert_equals(false, table_get_at(&table, key, 2, &ent), __FILE__, __LINE__);
+
+  table_clr(&table);
+  config_clr(&config);
+}
+
+static void realm_conflict_test(void) {
+  uint8_t int_ip[4] = INT_PROXY_IP;
+  uint8_t ext_ip[4] = EXT_PROXY_IP;
+  uint8_t prx_ip[4] = PROXY_IP;
+  uint8_t snd_ip[4] = MEDIA_IP;
+  uint8_t sbc_ip[4] = SBC_IP;
+  uint8_t other_ip[4] = {10, 1, 40, 122};
+
+  set_config(int_ip, ext_ip);
+
+  uint16_t prx_port = 32768;
+  __be16 key = htons(prx_port);
+
+  uint8_t id = realm_set(&config, "carrier", addr_v4(htonl(atohl(prx_ip))), addr_v4(htonl(atohl(prx_ip))));
+  struct realm realm;
+  realm_get(&config, id, &realm);
+
+  // one session in the realm, one outside of it on other_ip
+  struct table_entry ent = {
+    .sender_addr    = addr_v4(htonl(atohl(snd_ip))),
+    .sender_port    = htons(18572),
+    .receiver_addr  = addr_v4(htonl(atohl(snd_ip))),
+    .receiver_port  = htons(18570),
+    .sbc_addr       = addr_v4(htonl(atohl(sbc_ip))),
+    .sbc_port       = htons(40970),
+    .int_proxy_addr = realm.int_proxy_addr,
+    .ext_proxy_addr = realm.ext_proxy_addr,
+    .realm          = id,
+  };
+  table_put(&table, key, &ent);
+  ent.sbc_port       = htons(40980);
+  ent.int_proxy_addr = addr_v4(htonl(atohl(other_ip)));
+  ent.ext_proxy_addr = addr_v4(htonl(atohl(ext_ip)));
+  ent.realm          = 0;
+  table_put(&table, key, &ent);
+
+  // moving the realm onto other_ip must not replace the session there
+  realm_set(&config, "carrier", addr_v4(htonl(atohl(other_ip))), addr_v4(htonl(atohl(ext_ip))));
+  table_realm_changed(&table, id);
+
+  assert_session(prx_port, htonl(atohl(prx_ip)), prx_ip, prx_ip, 40970, __FILE__, __LINE__);
+  assert_session(prx_port, htonl(atohl(other_ip)), other_ip, ext_ip, 40980, __FILE__, __LINE__);
+  assert_equals(true, table_get_at(&table, key, 1, &ent), __FILE__, __LINE__);
+  assert_equals(false, table_get_at(&table, key, 2, &ent), __FILE__, __LINE__);
+
+  table_clr(&table);
+  config_clr(&config);
+}
+
+static void touch_session(uint16_t prx_port, unsigned long now) {
+  struct config cfg;
+  config_get(&config, &cfg);
+  struct table_entry ent;
+  struct routing rt;
+  if(get_routing(&table, htons(prx_port), ADDR_NONE, ADDR_NONE, 0, &cfg, &ent, &rt)) {
+    table_touch(&rt, now);
+    return;
+  }
+  exit(-1);
+}
+
+static void last_expired_function(__be16 index, struct table_entry *entry, void *arg) {
+  uint16_t *last_expired = arg;
+  *last_expired = ntohs(index);
+}
+
+static void expire_test(void) {
+  uint8_t int_ip[4] = PROXY_IP;
+  uint8_t ext_ip[4] = PROXY_IP;
+  uint8_t snd_ip[4] = MEDIA_IP;
+  uint8_t sbc_ip[4] = SBC_IP;
+  uint8_t prx_ip[4] = PROXY_IP;
+  uint16_t last_expired = 0;
+  struct table_entry ent;
+
+  set_config(int_ip, ext_ip);
+
+  // a plain session on port 32768, and a cascade on 32770 and 32772 of which
+  // only the first leg gets packets, all created at jiffies 0
+  add_route(32768, snd_ip, 18562, snd_ip, 18560, sbc_ip, 40960);
+  add_route(32770, snd_ip, 18566, snd_ip, 18564, prx_ip, 32772);
+  add_route(32772, snd_ip, 18570, snd_ip, 18568, prx_ip, 32770);
+
+  assert_equals(0, table_expire(&table, 5 * HZ, 5 * HZ, last_expired_function, &last_expired), __FILE__, __LINE__);
+
+  touch_session(32768, 10 * HZ);
+  touch_session(32770, 10 * HZ);
+  assert_equals(0, table_expire(&table, 10 * HZ, 5 * HZ, last_expired_function, &last_expired), __FILE__, __LINE__);
+
+  touch_session(32770, 20 * HZ);
+  assert_equals(1, table_expire(&table, 20 * HZ, 5 * HZ, last_expired_function, &last_expired), __FILE__, __LINE__);
+  assert_equals(32768, last_expired, __FILE__, __LINE__);
+  assert_equals(false, table_get(&table, htons(32768), ADDR_NONE, &ent), __FILE__, __LINE__);
+  assert_equals(true, table_get(&table, htons(32772), ADDR_NONE, &ent), __FILE__, __LINE__);
+
+  assert_equals(2, table_expire(&table, 30 * HZ, 5 * HZ, last_expired_function, &last_expired), __FILE__, __LINE__);
+  assert_equals(0, table_next(&table, 0), __FILE__, __LINE__);
+}
+
+static void *set_offset_function(struct table_state *state, void *arg) {
+  state->offset = *(uint16_t *)arg;
+  return arg;
+}
+
+static uint16_t get_offset(struct table *t, struct config_store *store, uint16_t prx_port) {
+  struct config cfg;
+  struct table_entry ent;
+  struct routing rt;
+  uint16_t offset = 0;
+  config_get(store, &cfg);
+  if(get_routing(t, htons(prx_port), ADDR_NONE, ADDR_NONE, 0, &cfg, &ent, &rt)) {
+    offset = rt.state->offset;
+  }
+  return offset;
+}
+
+static void adopt_test(void) {
+  static struct config_store staged_config;
+  static struct table staged;
+  uint8_t int_ip[4] = PROXY_IP;
+  uint8_t ext_ip[4] = PROXY_IP;
+  uint8_t snd_ip[4] = MEDIA_IP;
+  uint8_t sbc_ip[4] = SBC_IP;
+  uint16_t offset = 7;
+  struct config cfg;
+  struct table_entry ent;
+  struct routing rt;
+
+  set_config(int_ip, ext_ip);
+  add_route(32768, snd_ip, 18562, snd_ip, 18560, sbc_ip, 40960);
+  add_route(32770, snd_ip, 18566, snd_ip, 18564, sbc_ip, 40962);
+  config_get(&config, &cfg);
+  assert_equals(true, get_routing(&table, htons(32768), ADDR_NONE, ADDR_NONE, 0, &cfg, &ent, &rt), __FILE__, __LINE__);
+  table_atomically(&rt, set_offset_function, &offset);
+
+  // the staged instance keeps 32768 and adds 32772, 32770 is dropped
+  config_init(&staged_config);
+  table_init(&staged, &staged_config);
+  config_set(&staged_config, &cfg);
+  memset(&ent, 0, sizeof(ent));
+  ent.sender_addr   = addr_v4(htonl(atohl(snd_ip)));
+  ent.sender_port   = htons(18562);
+  ent.receiver_addr = addr_v4(htonl(atohl(snd_ip)));
+  ent.receiver_port = htons(18560);
+  ent.sbc_addr      = addr_v4(htonl(atohl(sbc_ip)));
+  ent.sbc_port      = htons(40960);
+  table_put(&staged, htons(32768), &ent);
+  ent.sbc_port      = htons(40964);
+  table_put(&staged, htons(32772), &ent);
+
+  table_adopt(&staged, &table);
+  assert_equals(7, get_offset(&staged, &staged_config, 32768), __FILE__, __LINE__);
+  assert_equals(0, get_offset(&staged, &staged_config, 32772), __FILE__, __LINE__);
+
+  // both tables share the state until the replaced one is gone
+  offset = 9;
+  assert_equals(true, get_routing(&staged, htons(32768), ADDR_NONE, ADDR_NONE, 0, &cfg, &ent, &rt), __FILE__, __LINE__);
+  table_atomically(&rt, set_offset_function, &offset);
+  assert_equals(9, get_offset(&table, &config, 32768), __FILE__, __LINE__);
+
+  table_release(&table);
+  table_destroy(&table);
+  assert_equals(9, get_offset(&staged, &staged_config, 32768), __FILE__, __LINE__);
+  assert_equals(false, table_get(&staged, htons(32770), ADDR_NONE, &ent), __FILE__, __LINE__);
+  table_release(&staged);
+  table_destroy(&staged);
+}
+
+static void sessions_key_test(void) {
+  static struct table other;
+  uint8_t int_ip[4] = PROXY_IP;
+  uint8_t ext_ip[4] = PROXY_IP;
+  uint8_t snd_ip[4] = MEDIA_IP;
+  uint8_t sbc_ip[4] = SBC_IP;
+  struct table_entry ent;
+
+  set_config(int_ip, ext_ip);
+  assert_equals(false, sessions_exist(), __FILE__, __LINE__);
+
+  // the hooks run from the first session on and until the last one is gone
+  add_route(32768, snd_ip, 18562, snd_ip, 18560, sbc_ip, 40960);
+  assert_equals(true, sessions_exist(), __FILE__, __LINE__);
+  add_route(32770, snd_ip, 18566, snd_ip, 18564, sbc_ip, 40962);
+  table_del(&table, htons(32768), ADDR_NONE);
+  assert_equals(true, sessions_exist(), __FILE__, __LINE__);
+  table_del(&table, htons(32770), ADDR_NONE);
+  assert_equals(false, sessions_exist(), __FILE__, __LINE__);
+
+  // a deletion that does not match does not count
+  add_route(32768, snd_ip, 18562, snd_ip, 18560, sbc_ip, 40960);
+  table_del(&table, htons(32772), ADDR_NONE);
+  assert_equals(true, sessions_exist(), __FILE__, __LINE__);
+  table_clr(&table);
+  assert_equals(false, sessions_exist(), __FILE__, __LINE__);
+
+  // as long as any table holds sessions
+  table_init(&other, &config);
+  add_route(32768, snd_ip, 18562, snd_ip, 18560, sbc_ip, 40960);
+  table_get(&table, htons(32768), ADDR_NONE, &ent);
+  table_put(&other, htons(32768), &ent);
+  assert_equals(true, table_has(&other, htons(32768)), __FILE__, __LINE__);
+  assert_equals(2, sessions_key.count, __FILE__, __LINE__);
+  assert_equals(0, table_expire(&table, 0, 5 * HZ, NULL, NULL), __FILE__, __LINE__);
+  assert_equals(1, table_expire(&table, 10 * HZ, 5 * HZ, NULL, NULL), __FILE__, __LINE__);
+  assert_equals(true, sessions_exist(), __FILE__, __LINE__);
+  table_release(&other);
+  table_destroy(&other);
+  assert_equals(false, sessions_exist(), __FILE__, __LINE__);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // main function
 //
 
 int main(int argc, char **argv) {
-  table_init();
+  table_init(&table, &config);
 
-  config_init();
+  config_init(&config);
 
 
   new_table_contains_no_entries_test();
@@ -390,10 +970,48 @@ int main(int argc, char **argv) {
   cascade_test();
 
   printf("\n");
-  table_init();
+  table_init(&table, &config);
   new_table_contains_no_entries_test();
   short_circuiting_test();
 
+  printf("\n");
+  table_init(&table, &config);
+  config_change_test();
+
+  table_init(&table, &config);
+  table_next_test();
+
+  printf("\n");
+  table_init(&table, &config);
+  shared_port_test();
+  shared_sbc_test();
+
+  printf("\n");
+  table_init(&table, &config);
+  ipv6_session_test();
+
+  printf("\n");
+  table_init(&table, &config);
+  interworking_test();
+
+  printf("\n");
+  table_init(&table, &config);
+  realm_test();
+  realm_conflict_test();
+
+  printf("\n");
+  table_init(&table, &config);
+  expire_test();
+  new_table_contains_no_entries_test();
+
+  printf("\n");
+  table_init(&table, &config);
+  adopt_test();
+
+  printf("\n");
+  table_init(&table, &config);
+  sessions_key_test();
+
   printf(KGRN"SUCCESS"KNRM"\n");
   exit(0);
 }
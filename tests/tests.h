@@ -59,6 +59,8 @@
 
 #define THIS_MODULE 0
 
+#define ____cacheline_aligned_in_smp __attribute__((__aligned__(64)))
+
 // provide spinlock mock definitions
 
 typedef int spinlock_t;
@@ -66,6 +68,88 @@ typedef int spinlock_t;
 #define spin_lock_bh(_)   do{}while(0)
 #define spin_unlock_bh(_) do{}while(0)
 
+// provide seqlock mock definitions
+
+typedef int seqlock_t;
+#define seqlock_init(_)          do{}while(0)
+#define write_seqlock_bh(_)      do{}while(0)
+#define write_sequnlock_bh(_)    do{}while(0)
+#define read_seqbegin(_)         0
+#define read_seqretry(_, seq)    ((void)(seq), 0)
+
+// provide static key mock definitions, a branch is taken while its count is
+// positive
+
+struct static_key_false {
+  int count;
+};
+
+#define DEFINE_STATIC_KEY_FALSE(name)  struct static_key_false name = { 0 }
+#define DECLARE_STATIC_KEY_FALSE(name) extern struct static_key_false name
+#define static_branch_unlikely(key)    ((key)->count > 0)
+#define static_branch_inc(key)         ((key)->count++)
+#define static_branch_dec(key)         ((key)->count--)
+
+// provide RCU mock definitions
+
+#define __rcu
+
+struct rcu_head {
+};
+
+#define rcu_read_lock()                   do{}while(0)
+#define rcu_read_unlock()                 do{}while(0)
+#define rcu_dereference(p)                (p)
+#define rcu_access_pointer(p)             (p)
+#define rcu_dereference_protected(p, c)   (p)
+#define lockdep_is_held(_)                1
+#define rcu_assign_pointer(p, v)          ((p) = (v))
+#define RCU_INIT_POINTER(p, v)            ((p) = (v))
+#define kfree_rcu(p, field)               free(p)
+#define call_rcu(head, fn)                (fn)(head)
+
+#define __force
+
+#define container_of(ptr, type, member)   ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define READ_ONCE(x)                      (x)
+#define WRITE_ONCE(x, v)                  ((x) = (v))
+#define smp_rmb()                         do{}while(0)
+#define smp_wmb()                         do{}while(0)
+
+#define get_random_bytes(buf, nbytes) memset(buf, 0, nbytes)
+
+// provide jiffies mock definitions, the clock stands still
+
+#define HZ                  100
+#define jiffies             0UL
+#define time_after(a, b)    ((long)((b) - (a)) < 0)
+
+// provide bitmap mock definitions
+
+#define BITS_PER_LONG (8 * sizeof(long))
+#define DECLARE_BITMAP(name, bits) unsigned long name[((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG]
+
+#define set_bit(nr, addr)   ((addr)[(nr) / BITS_PER_LONG] |= 1UL << ((nr) % BITS_PER_LONG))
+#define clear_bit(nr, addr) ((addr)[(nr) / BITS_PER_LONG] &= ~(1UL << ((nr) % BITS_PER_LONG)))
+#define test_bit(nr, addr)  (((addr)[(nr) / BITS_PER_LONG] >> ((nr) % BITS_PER_LONG)) & 1)
+#define bitmap_zero(addr, bits) memset(addr, 0, sizeof(unsigned long) * (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG))
+
+static inline unsigned long find_next_bit(const unsigned long *addr, unsigned long size, unsigned long offset) {
+  for(; offset < size; offset++) {
+    if(test_bit(offset, addr)) {
+      return offset;
+    }
+  }
+  return size;
+}
+
+// provide dst mock definitions
+
+struct dst_entry;
+
+#define dst_release(dst) ((void)(dst))
+
 // provide sk_buff mock definitions
 
 struct net_device {
@@ -145,9 +229,27 @@ struct nf_hook_ops {
 
 #define gfp_t unsigned
 #define GFP_KERNEL 0
-
-void *kmalloc(size_t size, gfp_t flags);
-void kfree(const void *objp);
+#define GFP_ATOMIC 0
+
+// like kmalloc, align to the cache line (power of two sized objects are
+// naturally aligned) and poison the memory like slub_debug=P does, so fields
+// that are never initialized do not read as zero by chance
+static inline void *kmalloc(size_t size, gfp_t flags) {
+  void *objp = aligned_alloc(64, (size + 63) & ~63);
+  if(objp) {
+    memset(objp, 0x5a, size);
+  }
+  return objp;
+}
+#define kfree(objp) free((void *)(objp))
+
+static inline void *kzalloc(size_t size, gfp_t flags) {
+  void *objp = kmalloc(size, flags);
+  if(objp) {
+    memset(objp, 0, size);
+  }
+  return objp;
+}
 long copy_from_user(void *to, const void *from, unsigned long n);
 
 struct inode {